@@ -8,29 +8,41 @@ namespace osmwave {
     }
 
     void ObjWriter::comment(const std::string& comment) {
-        stream << "# " << comment << std::endl;
+        stream << "# " << comment << '\n';
     }
 
     void ObjWriter::materialLibrary(const std::string& path) {
-        stream << "mtllib" << path << std::endl;
+        stream << "mtllib" << path << '\n';
     }
 
     void ObjWriter::material(const std::string& material) {
-        stream << "mtl" << material << std::endl;
+        stream << "mtl" << material << '\n';
+    }
+
+    void ObjWriter::group(const std::string& group) {
+        stream << "g " << group << '\n';
     }
 
     void ObjWriter::checkpoint() {
         offset = vertIndex;
     }
 
+    void ObjWriter::clearCheckpoint() {
+        offset = 0;
+    }
+
+    int ObjWriter::nextVertex() const {
+        return vertIndex;
+    }
+
     int ObjWriter::vertex(double x, double y, double z) {
-        stream << "v " << x << ' ' << y << ' ' << z << std::endl;
+        stream << "v " << x << ' ' << y << ' ' << z << '\n';
         return vertIndex++;
     }
 
     int ObjWriter::vertex(double x, double y, double z, double nx, double ny, double nz) {
         int n = vertex(x, y, z);
-        stream << "vn " << nx << ' ' << ny << ' ' << nz << std::endl;
+        stream << "vn " << nx << ' ' << ny << ' ' << nz << '\n';
         return n;
     }
 
@@ -2,6 +2,7 @@
 #define _OBJEWRITER_HXX_
 
 #include <ostream>
+#include <string>
 
 using namespace std;
 
@@ -20,7 +21,14 @@ namespace osmwave {
 
         void material(const std::string& materialName);
 
+        void group(const std::string& groupName);
+
         void checkpoint();
+        // Face indices written after this are the indices returned by vertex()
+        void clearCheckpoint();
+
+        // Index the next vertex written will get
+        int nextVertex() const;
 
         int vertex(double x, double y, double z);
         int vertex(double x, double y, double z, double nx, double ny, double nz);
@@ -0,0 +1,54 @@
+#include <cstdlib>
+#include <new>
+#include "alloccount.hxx"
+
+// Replacement global allocation functions, counting allocations per
+// thread. The counter is a plain thread local, so counting costs an
+// increment.
+
+static thread_local size_t allocations = 0;
+
+namespace osmwave {
+    size_t allocation_count() {
+        return allocations;
+    }
+}
+
+void* operator new(std::size_t size) {
+    allocations++;
+    void* p = std::malloc(size ? size : 1);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+
+    return p;
+}
+
+void* operator new[](std::size_t size) {
+    return operator new(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+    allocations++;
+    return std::malloc(size ? size : 1);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept {
+    return operator new(size, std::nothrow);
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, const std::nothrow_t&) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p, const std::nothrow_t&) noexcept {
+    std::free(p);
+}
@@ -0,0 +1,13 @@
+#ifndef __ALLOCCOUNT_HXX__
+#define __ALLOCCOUNT_HXX__
+
+#include <cstddef>
+
+namespace osmwave {
+    // Number of heap allocations made through operator new by the calling
+    // thread. Allocations made with malloc directly, as by C libraries,
+    // are not counted.
+    size_t allocation_count();
+}
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef __ARENA_HXX__
+#define __ARENA_HXX__
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+namespace osmwave {
+    // Bump allocator for short lived scratch memory. Nothing is freed
+    // individually; reset() makes all memory available again. After a
+    // reset, memory spread over several blocks is merged into one block of
+    // the same total size, so once the arena has grown to its high water
+    // mark, allocating from it never touches the heap.
+    class Arena {
+        std::vector<std::unique_ptr<char[]>> blocks;
+        std::vector<size_t> blockSizes;
+        size_t current;
+        size_t used;
+
+    public:
+        Arena(size_t initialSize = 64 * 1024) : current(0), used(0) {
+            addBlock(initialSize);
+        }
+
+        template <typename T>
+        T* alloc(size_t n) {
+            size_t size = n * sizeof(T);
+            size_t offset = (used + alignof(T) - 1) & ~(alignof(T) - 1);
+
+            while (offset + size > blockSizes[current]) {
+                if (current + 1 == blocks.size()) {
+                    addBlock(std::max(size, blockSizes[current] * 2));
+                }
+                current++;
+                offset = 0;
+            }
+
+            used = offset + size;
+            return reinterpret_cast<T*>(blocks[current].get() + offset);
+        }
+
+        void reset() {
+            if (blocks.size() > 1) {
+                size_t total = 0;
+                for (size_t size : blockSizes) {
+                    total += size;
+                }
+                blocks.clear();
+                blockSizes.clear();
+                addBlock(total);
+            }
+
+            current = 0;
+            used = 0;
+        }
+
+    private:
+        void addBlock(size_t size) {
+            blocks.push_back(std::unique_ptr<char[]>(new char[size]));
+            blockSizes.push_back(size);
+        }
+    };
+}
+
+#endif
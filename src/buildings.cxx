@@ -0,0 +1,135 @@
+#include <array>
+#include <iostream>
+#include "buildings.hxx"
+#include "earcut.hxx"
+#include "meshopt.hxx"
+
+namespace osmwave {
+    // Buildings per batch, and per chunk of a batch, when optimizing
+    const size_t RING_BATCH_BUILDINGS = 16384;
+    const size_t RING_CHUNK_BUILDINGS = 256;
+
+    RingWriter::RingWriter(ObjWriter& writer, bool optimize) :
+        writer(writer), optimize(optimize), batchBuildings(0), triangles(0), missesBefore(0), missesAfter(0) {
+    }
+
+    void RingWriter::ring(const double* coords, int nVerts, double elevation, double height) {
+        if (optimize) {
+            batchRing(coords, nVerts, elevation, height);
+            return;
+        }
+
+        ringWalls(coords, nVerts, elevation, height);
+        flatRoof(nVerts);
+    }
+
+    void RingWriter::ringWalls(const double* coords, int nVerts, double elevation, double height) {
+        int vertexCount = 0;
+        writer.checkpoint();
+        for (const double* i = coords; i != coords + nVerts * 2; i += 2) {
+            writer.vertex(*(i + 1), elevation, *i);
+            writer.vertex(*(i + 1), elevation + height, *i);
+
+            if (vertexCount) {
+                writer.beginFace();
+                writer << (vertexCount - 2) << (vertexCount) << (vertexCount + 1) << (vertexCount - 1);
+                writer.endFace();
+            }
+
+            vertexCount += 2;
+        }
+    }
+
+    void RingWriter::flatRoof(int nVerts) {
+        writer.beginFace();
+        for (int i = 0; i < nVerts; i++) {
+            writer << (i * 2 + 1);
+        }
+        writer.endFace();
+    }
+
+    // Same vertices, and faces facing the same way, as ringWalls and
+    // flatRoof, with the quads split in two and the roof ear clipped
+    void RingWriter::batchRing(const double* coords, int nVerts, double elevation, double height) {
+        uint32_t base = vertices.size() / 3;
+
+        for (int i = 0; i < nVerts; i++) {
+            double x = coords[i * 2], y = coords[i * 2 + 1];
+            vertices.insert(vertices.end(), {y, elevation, x, y, elevation + height, x});
+
+            if (i) {
+                uint32_t v = base + i * 2;
+                indices.insert(indices.end(), {v - 2, v, v + 1, v - 2, v + 1, v - 1});
+            }
+        }
+
+        // The closing vertex repeats the first, which earcut does not want
+        vector<vector<array<double, 2>>> roof(1);
+        double area = 0;
+        for (int i = 0; i < nVerts - 1; i++) {
+            roof[0].push_back({{coords[i * 2], coords[i * 2 + 1]}});
+            area += coords[i * 2] * coords[i * 2 + 3] - coords[i * 2 + 2] * coords[i * 2 + 1];
+        }
+
+        mapbox::Earcut<uint32_t> earcut;
+        earcut(roof);
+        for (size_t i = 0; i < earcut.indices.size(); i += 3) {
+            uint32_t a = earcut.indices[i], b = earcut.indices[i + 1], c = earcut.indices[i + 2];
+            const auto& pa = roof[0][a];
+            const auto& pb = roof[0][b];
+            const auto& pc = roof[0][c];
+            double triangleArea = (pb[0] - pa[0]) * (pc[1] - pa[1]) - (pc[0] - pa[0]) * (pb[1] - pa[1]);
+            if ((triangleArea < 0) != (area < 0)) {
+                swap(b, c);
+            }
+            indices.insert(indices.end(), {base + a * 2 + 1, base + b * 2 + 1, base + c * 2 + 1});
+        }
+
+        chunks.resize(indices.size() / 3, batchBuildings / RING_CHUNK_BUILDINGS);
+
+        if (++batchBuildings == RING_BATCH_BUILDINGS) {
+            flush();
+        }
+    }
+
+    void RingWriter::flush() {
+        if (!indices.empty()) {
+            writeBatch();
+        }
+
+        vertices.clear();
+        indices.clear();
+        chunks.clear();
+        batchBuildings = 0;
+    }
+
+    void RingWriter::writeBatch() {
+        size_t nVertices = vertices.size() / 3;
+        vector<uint32_t> order;
+        missesBefore += vertex_cache_misses(indices.data(), indices.size(), nVertices);
+        optimize_mesh(indices, chunks, nVertices, order);
+        missesAfter += vertex_cache_misses(indices.data(), indices.size(), nVertices);
+        triangles += indices.size() / 3;
+
+        writer.checkpoint();
+        for (uint32_t i : order) {
+            writer.vertex(vertices[i * 3], vertices[i * 3 + 1], vertices[i * 3 + 2]);
+        }
+        for (size_t i = 0; i < indices.size(); i += 3) {
+            writer.beginFace();
+            writer << (int)indices[i] << (int)indices[i + 1] << (int)indices[i + 2];
+            writer.endFace();
+        }
+    }
+
+    bool RingWriter::finish() {
+        flush();
+
+        if (triangles) {
+            cerr << "Building vertex cache miss ratio: " << (double)missesBefore / triangles << " before optimization, " <<
+                (double)missesAfter / triangles << " after" << endl;
+        }
+
+        return true;
+    }
+}
@@ -0,0 +1,64 @@
+#ifndef __BUILDINGS_HXX__
+#define __BUILDINGS_HXX__
+
+#include <cstdint>
+#include <vector>
+#include "ObjWriter.hxx"
+
+using namespace std;
+
+namespace osmwave {
+    // Receives building rings as nVerts interleaved x/y projected
+    // coordinates, closed so that the last vertex repeats the first, with
+    // the elevation of the building's base and its height above it.
+    class RingSink {
+    public:
+        virtual ~RingSink() {}
+
+        virtual void ring(const double* coords, int nVerts, double elevation, double height) = 0;
+
+        // Called where everything received so far must be in the output,
+        // like at the end of a chunk of the chunk index
+        virtual void flush() {}
+
+        // Called once no more rings will arrive; returns false, after
+        // printing why, if not every ring made it to the output
+        virtual bool finish() { return true; }
+    };
+
+    // Writes rings as walls and a flat roof.
+    //
+    // When optimizing, walls and roofs are triangulated and collected in
+    // batches, which are optimized for the vertex cache with optimize_mesh
+    // before they are written, in chunks of a few hundred buildings.
+    class RingWriter : public RingSink {
+        ObjWriter& writer;
+        bool optimize;
+
+        // The batch: OBJ positions, triangles and the chunk of each
+        vector<double> vertices;
+        vector<uint32_t> indices;
+        vector<uint32_t> chunks;
+        size_t batchBuildings;
+
+        // Totals over all batches
+        size_t triangles;
+        size_t missesBefore;
+        size_t missesAfter;
+
+    public:
+        RingWriter(ObjWriter& writer, bool optimize = false);
+
+        void ring(const double* coords, int nVerts, double elevation, double height);
+        void flush();
+        bool finish();
+
+    private:
+        void ringWalls(const double* coords, int nVerts, double elevation, double height);
+        void flatRoof(int nVerts);
+        void batchRing(const double* coords, int nVerts, double elevation, double height);
+        void writeBatch();
+    };
+}
+
+#endif
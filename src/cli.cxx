@@ -1,7 +1,12 @@
 #include <iostream>
 #include <boost/program_options.hpp>
 #include <string>
+#include <vector>
+#include <memory>
+#include <sstream>
+#include <fstream>
 #include "osmwave.hxx"
+#include "outputstream.hxx"
 
 using namespace std;
 
@@ -11,9 +16,22 @@ int main(int argc, char* argv[]) {
     desc.add_options()
         ("elevation_dir,e", po::value<string>()->required(), "Set directory containing elevation data")
         ("proj,p", po::value<string>(), "Projection definition")
-        ("osm_file", po::value<string>()->required(), "Input OSM data file");
+        ("output,o", po::value<string>(), "Output file, compressed if name ends with .gz or .zst (default: standard out)")
+        ("bbox,b", po::value<string>(), "Only build areas inside bounding box, given as min_lon,min_lat,max_lon,max_lat")
+        ("clip-polygon,c", po::value<string>(), "Only build areas inside polygon from Osmosis .poly file")
+        ("terrain,t", "Also build terrain, with buildings placed on it")
+        ("highways", "Also build highways, as ribbons draped on the ground")
+        ("instances,i", po::value<string>(), "Leave repeated building shapes out of the model; write each once to <name>_prototypes.obj, and all their placements to this CSV file")
+        ("hilbert-order", "Write buildings ordered along a Hilbert curve, so nearby buildings are close in the file")
+        ("chunk-index", po::value<string>(), "Write buildings in Hilbert order, with the byte and vertex ranges of each chunk in this CSV file")
+        ("lod", po::value<string>(), "Also write simplified buildings, merged into blocks, for each of these comma separated error thresholds in meters")
+        ("lod-output", po::value<string>(), "Write the levels of detail to files named with this prefix, followed by the level number and .obj")
+        ("optimize-mesh", "Order triangles and vertices of terrain and buildings for faster rendering; buildings are written as triangles")
+        ("stats", "Print processing statistics, like heap allocations made through operator new")
+        ("float", "Write geometry relative to a local origin and keep the terrain mesh in single precision, if precise enough for the extent")
+        ("osm_file", po::value<vector<string>>()->required(), "Input OSM data files; objects in several files, like those on the border of two extracts, are read once");
     po::positional_options_description positionOptions;
-    positionOptions.add("osm_file", 1);
+    positionOptions.add("osm_file", -1);
 
     po::variables_map vm;
     try {
@@ -29,15 +47,125 @@ int main(int argc, char* argv[]) {
         return 1;
     }
 
-    const string& input_filename = vm["osm_file"].as<string>();
+    const vector<string>& input_filenames = vm["osm_file"].as<vector<string>>();
     const string& elevPath(vm["elevation_dir"].as<string>());
-    const string* projDef = nullptr;
+    osmwave::Options options;
 
     if (vm.count("proj")) {
-        projDef = &vm["proj"].as<string>();
+        options.projDef = &vm["proj"].as<string>();
     }
 
-    osmwave::osm_to_obj(input_filename, elevPath, projDef);
+    options.terrain = vm.count("terrain") > 0;
+    options.highways = vm.count("highways") > 0;
+    options.stats = vm.count("stats") > 0;
+    options.singlePrecision = vm.count("float") > 0;
+    options.hilbertOrder = vm.count("hilbert-order") > 0;
+    options.optimizeMesh = vm.count("optimize-mesh") > 0;
+
+    unique_ptr<osmwave::Clip> clip;
+    if (vm.count("bbox")) {
+        istringstream bboxStream(vm["bbox"].as<string>());
+        double west, south, east, north;
+        char c1, c2, c3;
+        if (!(bboxStream >> west >> c1 >> south >> c2 >> east >> c3 >> north) ||
+            c1 != ',' || c2 != ',' || c3 != ',' || west >= east || south >= north) {
+            cerr << "Error invalid bounding box \"" << vm["bbox"].as<string>() << "\"" << endl << endl;
+            cerr << desc << endl;
+            return 1;
+        }
+        clip.reset(new osmwave::Clip(west, south, east, north));
+    }
+
+    if (vm.count("clip-polygon")) {
+        if (!clip) {
+            clip.reset(new osmwave::Clip(-180, -90, 180, 90));
+        }
+        if (!clip->readPoly(vm["clip-polygon"].as<string>())) {
+            return 1;
+        }
+    }
+
+    if (vm.count("lod")) {
+        istringstream lodStream(vm["lod"].as<string>());
+        double threshold;
+        char separator = ',';
+        while (separator == ',' && lodStream >> threshold && threshold > 0) {
+            options.lodThresholds.push_back(threshold);
+            separator = 0;
+            lodStream >> separator;
+        }
+        if (separator || options.lodThresholds.empty()) {
+            cerr << "Error invalid level of detail thresholds \"" << vm["lod"].as<string>() << "\"" << endl << endl;
+            cerr << desc << endl;
+            return 1;
+        }
+        if (!vm.count("lod-output")) {
+            cerr << "Error --lod requires --lod-output" << endl << endl;
+            cerr << desc << endl;
+            return 1;
+        }
+        options.lodPrefix = vm["lod-output"].as<string>();
+    }
+
+    unique_ptr<osmwave::OutputFile> output;
+    if (vm.count("output")) {
+        output.reset(new osmwave::OutputFile(vm["output"].as<string>()));
+        if (!output->isOpen()) {
+            return 1;
+        }
+        options.output = &output->stream();
+    }
+
+    ofstream instances;
+    unique_ptr<osmwave::OutputFile> prototypes;
+    if (vm.count("instances")) {
+        const string& path = vm["instances"].as<string>();
+        instances.open(path.c_str());
+        if (!instances.is_open()) {
+            cerr << "Unable to open instances file " << path << endl;
+            return 1;
+        }
+        options.instances = &instances;
+
+        // Prototypes go next to the sidecar: houses.csv gets houses_prototypes.obj
+        size_t dot = path.find_last_of('.');
+        size_t slash = path.find_last_of('/');
+        string stem = dot != string::npos && (slash == string::npos || dot > slash) ? path.substr(0, dot) : path;
+        prototypes.reset(new osmwave::OutputFile(stem + "_prototypes.obj"));
+        if (!prototypes->isOpen()) {
+            return 1;
+        }
+        options.prototypes = &prototypes->stream();
+    }
+
+    ofstream chunkIndex;
+    if (vm.count("chunk-index")) {
+        chunkIndex.open(vm["chunk-index"].as<string>().c_str());
+        if (!chunkIndex.is_open()) {
+            cerr << "Unable to open chunk index file " << vm["chunk-index"].as<string>() << endl;
+            return 1;
+        }
+        options.chunkIndex = &chunkIndex;
+    }
+
+    options.clip = clip.get();
+    if (!osmwave::osm_to_obj(input_filenames, elevPath, options)) {
+        return 1;
+    }
+
+    if (prototypes && !prototypes->close()) {
+        return 1;
+    }
+
+    if (output) {
+        return output->close() ? 0 : 1;
+    }
+
+    cout.flush();
+    if (!cout) {
+        cerr << "Unable to write to standard out" << endl;
+        return 1;
+    }
 
     return 0;
 }
@@ -0,0 +1,193 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <limits>
+#include <algorithm>
+#include "clip.hxx"
+
+using namespace std;
+
+namespace osmwave {
+    Clip::Clip(double west, double south, double east, double north) :
+        west(west), south(south), east(east), north(north) {
+    }
+
+    bool Clip::readPoly(const string& path) {
+        ifstream file(path.c_str());
+        if (!file.is_open()) {
+            cerr << "Unable to open clip polygon " << path << '\n';
+            return false;
+        }
+
+        vector<vector<double>> polyRings;
+        double minLon = numeric_limits<double>::max();
+        double minLat = numeric_limits<double>::max();
+        double maxLon = -numeric_limits<double>::max();
+        double maxLat = -numeric_limits<double>::max();
+        string line;
+
+        // First line is the polygon's name; after that come sections, each
+        // a name line, "lon lat" coordinate lines and a terminating END.
+        // A final END closes the file.
+        getline(file, line);
+        while (getline(file, line)) {
+            istringstream header(line);
+            string name;
+            if (!(header >> name)) {
+                continue;
+            }
+            if (name == "END") {
+                break;
+            }
+
+            vector<double> ring;
+            while (getline(file, line)) {
+                istringstream coords(line);
+                double lon, lat;
+                if (coords >> lon >> lat) {
+                    ring.push_back(lon);
+                    ring.push_back(lat);
+                    minLon = min(minLon, lon);
+                    minLat = min(minLat, lat);
+                    maxLon = max(maxLon, lon);
+                    maxLat = max(maxLat, lat);
+                } else {
+                    string token;
+                    istringstream end(line);
+                    if ((end >> token) && token == "END") {
+                        break;
+                    }
+                    cerr << "Unparseable line in clip polygon " << path << ": \"" << line << "\"\n";
+                    return false;
+                }
+            }
+
+            if (ring.size() >= 6) {
+                polyRings.push_back(ring);
+            }
+        }
+
+        if (polyRings.empty()) {
+            cerr << "No rings found in clip polygon " << path << '\n';
+            return false;
+        }
+
+        if (max(west, minLon) > min(east, maxLon) || max(south, minLat) > min(north, maxLat)) {
+            cerr << "Clip polygon " << path << " is outside the bounding box" << '\n';
+            return false;
+        }
+
+        rings.swap(polyRings);
+        west = max(west, minLon);
+        south = max(south, minLat);
+        east = min(east, maxLon);
+        north = min(north, maxLat);
+
+        return true;
+    }
+
+    bool Clip::intersects(double minLon, double minLat, double maxLon, double maxLat) const {
+        return minLon <= east && maxLon >= west && minLat <= north && maxLat >= south;
+    }
+
+    // True if segments (ax, ay) - (bx, by) and (cx, cy) - (dx, dy) cross or touch
+    static bool segments_intersect(double ax, double ay, double bx, double by, double cx, double cy, double dx, double dy) {
+        double d1 = (dx - cx) * (ay - cy) - (dy - cy) * (ax - cx);
+        double d2 = (dx - cx) * (by - cy) - (dy - cy) * (bx - cx);
+        double d3 = (bx - ax) * (cy - ay) - (by - ay) * (cx - ax);
+        double d4 = (bx - ax) * (dy - ay) - (by - ay) * (dx - ax);
+        if (((d1 > 0 && d2 < 0) || (d1 < 0 && d2 > 0)) && ((d3 > 0 && d4 < 0) || (d3 < 0 && d4 > 0))) {
+            return true;
+        }
+
+        // Collinear or touching; overlapping boxes are enough at this scale
+        return (d1 == 0 || d2 == 0 || d3 == 0 || d4 == 0) &&
+            min(ax, bx) <= max(cx, dx) && min(cx, dx) <= max(ax, bx) &&
+            min(ay, by) <= max(cy, dy) && min(cy, dy) <= max(ay, by);
+    }
+
+    // Even-odd test of (x, y) against a closed ring of n lon/lat pairs
+    static bool ring_contains(const double* ring, size_t n, double x, double y) {
+        bool inside = false;
+        for (size_t i = 0, j = n - 1; i < n; j = i++) {
+            double xi = ring[i * 2], yi = ring[i * 2 + 1];
+            double xj = ring[j * 2], yj = ring[j * 2 + 1];
+            if (((yi > y) != (yj > y)) && (x < (xj - xi) * (y - yi) / (yj - yi) + xi)) {
+                inside = !inside;
+            }
+        }
+
+        return inside;
+    }
+
+    bool Clip::intersectsPath(const double* coords, size_t n, bool closed) const {
+        if (!n) {
+            return false;
+        }
+
+        double minLon = coords[0], maxLon = coords[0], minLat = coords[1], maxLat = coords[1];
+        for (size_t i = 0; i < n; i++) {
+            if (contains(coords[i * 2], coords[i * 2 + 1])) {
+                return true;
+            }
+            minLon = min(minLon, coords[i * 2]);
+            maxLon = max(maxLon, coords[i * 2]);
+            minLat = min(minLat, coords[i * 2 + 1]);
+            maxLat = max(maxLat, coords[i * 2 + 1]);
+        }
+
+        if (rings.empty()) {
+            return false;
+        }
+
+        for (auto& ring : rings) {
+            // A ring that does not cross the path is either entirely
+            // inside it or entirely outside
+            if (closed && ring_contains(coords, n, ring[0], ring[1])) {
+                return true;
+            }
+
+            size_t m = ring.size() / 2;
+            for (size_t i = 0, j = m - 1; i < m; j = i++) {
+                double x1 = ring[j * 2], y1 = ring[j * 2 + 1];
+                double x2 = ring[i * 2], y2 = ring[i * 2 + 1];
+                if (max(x1, x2) < minLon || min(x1, x2) > maxLon || max(y1, y2) < minLat || min(y1, y2) > maxLat) {
+                    continue;
+                }
+
+                for (size_t k = 1; k < n; k++) {
+                    if (segments_intersect(x1, y1, x2, y2, coords[k * 2 - 2], coords[k * 2 - 1], coords[k * 2], coords[k * 2 + 1])) {
+                        return true;
+                    }
+                }
+            }
+        }
+
+        return false;
+    }
+
+    bool Clip::contains(double lon, double lat) const {
+        if (lon < west || lon > east || lat < south || lat > north) {
+            return false;
+        }
+
+        if (rings.empty()) {
+            return true;
+        }
+
+        bool inside = false;
+        for (auto& ring : rings) {
+            size_t n = ring.size();
+            for (size_t i = 0, j = n - 2; i < n; j = i, i += 2) {
+                double xi = ring[i], yi = ring[i + 1];
+                double xj = ring[j], yj = ring[j + 1];
+                if (((yi > lat) != (yj > lat)) &&
+                    (lon < (xj - xi) * (lat - yi) / (yj - yi) + xi)) {
+                    inside = !inside;
+                }
+            }
+        }
+
+        return inside;
+    }
+}
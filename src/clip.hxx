@@ -0,0 +1,43 @@
+#ifndef __CLIP_HXX__
+#define __CLIP_HXX__
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+namespace osmwave {
+    // Region of interest in WGS84 degrees: a bounding box, optionally
+    // narrowed by a polygon read from an Osmosis .poly file.
+    class Clip {
+        double west;
+        double south;
+        double east;
+        double north;
+        // Polygon rings as interleaved lon/lat pairs; holes are evaluated
+        // with the even-odd rule, so no outer/inner bookkeeping is needed.
+        vector<vector<double>> rings;
+
+    public:
+        Clip(double west, double south, double east, double north);
+
+        bool readPoly(const string& path);
+
+        double getWest() const { return west; }
+        double getSouth() const { return south; }
+        double getEast() const { return east; }
+        double getNorth() const { return north; }
+        bool hasPolygon() const { return !rings.empty(); }
+
+        bool intersects(double minLon, double minLat, double maxLon, double maxLat) const;
+        bool contains(double lon, double lat) const;
+
+        // True if a path of n interleaved lon/lat pairs has a point in the
+        // region or crosses its border, or, if closed, encloses a part of
+        // the polygon. Paths only touching the region count as inside.
+        bool intersectsPath(const double* coords, size_t n, bool closed) const;
+    };
+}
+
+#endif
@@ -3,14 +3,24 @@
 #include <sstream>
 #include <iomanip>
 #include <math.h>
+#include <algorithm>
 #include "elevation.hxx"
 
 using namespace std;
 
 namespace osmwave {
     Elevation::Elevation(int south, int west, int north, int east, const string& tilesPath) : 
-    south(south), west(west), north(north), east(east), cols(east - west + 1), tileSize(0) {
-        tiles = new int8_t*[(north - south + 1) * cols];
+    south(south), west(west), north(north), east(east), cols(east - west + 1), nTiles((north - south + 1) * cols) {
+        tiles = new int8_t*[nTiles]();
+        tileSizes = new int[nTiles]();
+        ready.reset(new atomic<bool>[nTiles]);
+        for (int i = 0; i < nTiles; i++) {
+            ready[i] = false;
+        }
+
+        // Reading is mostly waiting for the disk, so one thread per tile
+        // up to the number of cores
+        loader.reset(new ThreadPool(min<unsigned int>(thread_count(), nTiles)));
 
         int i = 0;
         for (int lat = south; lat <= north; lat++) {
@@ -20,69 +30,99 @@ namespace osmwave {
                     (lon >= 0 ? 'E' : 'W') << setw(3) << abs(lon) << ".hgt";
 
                 string filePath = ss.str();
-
-                ifstream file(filePath.c_str(), ios::in | ios::binary | ios::ate);
-                if (file.is_open()) {
-                    int size = file.tellg();
-                    int currTileSize;
-                    switch (size) {
-                    case 2884802:
-                        currTileSize = 1201;
-                        break;
-                    case 25934402:
-                        currTileSize = 3601;
-                        break;
-                    default:
-                        cerr << "Unknown tile resolution in tile " << filePath << '\n';
-                    }
-
-                    if (tileSize != 0 && tileSize != currTileSize) {
-                        cerr << "Warning! Tiles of different resolutions detected. This will not work.\n";
-                    } else {
-                        tileSize = currTileSize;
-                    }
-
-                    tiles[i] = new int8_t[size];
-                    file.seekg(0, ios::beg);
-                    file.read((char*)tiles[i], size);
-
-                    if (!file) {
-                        cerr << "Read " << file.gcount() << " of expected " << size << " bytes from " << filePath << "\n";
-                    }
-
-                    //cerr << "Read " << file.gcount() << " bytes from " << filePath << '\n';
-                    file.close();
-
-                    i++;
-                } else {
-                    cerr << "Unable to open file " << ss.str() << '\n';
-                }
+                loader->submit([this, i, filePath]() { loadTile(i, filePath); });
+                i++;
             }
         }
     }
 
     Elevation::~Elevation() {
-        int i = 0;
-        for (int lat = south; lat <= north; lat++) {
-            for (int lon = west; lon <= east; lon++) {
-                delete tiles[i++];
+        // Finishes reading before the tiles go away
+        loader.reset();
+
+        for (int i = 0; i < nTiles; i++) {
+            delete[] tiles[i];
+        }
+
+        delete[] tiles;
+        delete[] tileSizes;
+    }
+
+    void Elevation::loadTile(int i, const string& filePath) {
+        ifstream file(filePath.c_str(), ios::in | ios::binary | ios::ate);
+        ostringstream messages;
+        if (file.is_open()) {
+            int size = file.tellg();
+            int currTileSize = 0;
+            switch (size) {
+            case 2884802:
+                currTileSize = 1201;
+                break;
+            case 25934402:
+                currTileSize = 3601;
+                break;
+            default:
+                messages << "Unknown tile resolution in tile " << filePath << '\n';
+            }
+
+            if (currTileSize) {
+                int8_t* tile = new int8_t[size];
+                file.seekg(0, ios::beg);
+                file.read((char*)tile, size);
+
+                if (!file) {
+                    messages << "Read " << file.gcount() << " of expected " << size << " bytes from " << filePath << "\n";
+                }
+
+                tiles[i] = tile;
+                tileSizes[i] = currTileSize;
             }
+            file.close();
+        } else {
+            messages << "Unable to open file " << filePath << '\n';
         }
 
-        delete tiles;
+        // In one piece, since tiles are read on several threads
+        cerr << messages.str();
+
+        {
+            lock_guard<mutex> lock(readyMutex);
+            ready[i] = true;
+        }
+        readyChanged.notify_all();
     }
 
-    double Elevation::getTileValue(int8_t* tile, int index) {
+    void Elevation::waitFor(int i) const {
+        if (ready[i].load(memory_order_acquire)) {
+            return;
+        }
+
+        unique_lock<mutex> lock(readyMutex);
+        readyChanged.wait(lock, [this, i]() { return ready[i].load(memory_order_acquire); });
+    }
+
+    double Elevation::getTileValue(int8_t* tile, int index) const {
         return tile[index] << 8 | tile[index + 1];
     }
 
-    double Elevation::elevation(double lat, double lon) {
+    int Elevation::clampToTile(double& lat, double& lon) const {
+        // Points just outside the loaded tiles, like the far nodes of ways
+        // crossing the border of an extract, get the elevation of the edge
+        lat = max((double)south, min(lat, north + 1 - 1e-9));
+        lon = max((double)west, min(lon, east + 1 - 1e-9));
+
+        return ((int)floor(lat) - south) * cols + (int)floor(lon) - west;
+    }
+
+    double Elevation::interpolate(int tileIndex, double lat, double lon) const {
+        int8_t* tile = tiles[tileIndex];
+        if (!tile) {
+            return 0;
+        }
+        int tileSize = tileSizes[tileIndex];
+
         double fLat = floor(lat);
         double fLon = floor(lon);
-        int tileRow = (int)fLat - south;
-        int tileCol = (int)fLon - west;
-        int8_t* tile = tiles[tileRow * cols + tileCol];
-
         double row = (lat - fLat) * (tileSize - 1);
         double col = (lon - fLon) * (tileSize - 1);
 
@@ -98,14 +138,42 @@ namespace osmwave {
         double v1 = v00 + (v10 - v00) * colFrac;
         double v2 = v01 + (v11 - v01) * colFrac;
 
-        double result = v1 + (v2 - v1) * rowFrac;
+        return v1 + (v2 - v1) * rowFrac;
+    }
+
+    double Elevation::elevation(double lat, double lon) const {
+        int tileIndex = clampToTile(lat, lon);
+        waitFor(tileIndex);
 
-        //cerr << "lat=" << lat << ", lon=" << lon << ", tileRow=" << tileRow <<
-        //    ", tileCol=" << tileCol << ", row=" << row << ", col=" << col << 
-        //    ", index=" << index <<
-        //    ", v00=" << v00 << ", v10=" << v10 << ", v01=" << v01 << ", v11=" << v11 << ", output=" << result << '\n';
-        //cerr << (int)tile[index] << ":" << (int)tile[index + 1] << endl;
+        return interpolate(tileIndex, lat, lon);
+    }
+
+    bool Elevation::contains(double lat, double lon) const {
+        return lat >= south && lat < north + 1 && lon >= west && lon < east + 1;
+    }
+
+    double Elevation::resolution() const {
+        for (int i = 0; i < nTiles; i++) {
+            waitFor(i);
+            if (tileSizes[i]) {
+                return 1.0 / (tileSizes[i] - 1);
+            }
+        }
+
+        // Three arc seconds, like SRTM outside the US, if no tile was read
+        return 1.0 / 1200;
+    }
 
-        return result;
+    void Elevation::elevations(const double* lat, const double* lon, double* result, size_t n) const {
+        int current = -1;
+        for (size_t i = 0; i < n; i++) {
+            double la = lat[i], lo = lon[i];
+            int tileIndex = clampToTile(la, lo);
+            if (tileIndex != current) {
+                waitFor(tileIndex);
+                current = tileIndex;
+            }
+            result[i] = interpolate(tileIndex, la, lo);
+        }
     }
 }
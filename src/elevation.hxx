@@ -1,28 +1,63 @@
 #ifndef __ELEVATION_HXX__
 #define __ELEVATION_HXX__
 
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
 #include <string>
+#include "parallel.hxx"
 
 using namespace std;
 
 namespace osmwave {
+    // Elevation from HGT tiles. Tiles are read on background threads,
+    // starting in the constructor; lookups only wait for the tile they
+    // need, if it is not read yet. All lookups may be made from any thread.
     class Elevation {
         int south;
         int west;
         int north;
         int east;
         int cols;
-        int tileSize;
+        int nTiles;
         int8_t** tiles;
+        int* tileSizes;
+        unique_ptr<atomic<bool>[]> ready;
+        mutable mutex readyMutex;
+        mutable condition_variable readyChanged;
+        unique_ptr<ThreadPool> loader;
 
     public:
         Elevation(int south, int west, int north, int east, const string& tilesPath);
         ~Elevation();
 
-        double elevation(double lat, double lon);
+        double elevation(double lat, double lon) const;
+        // Elevations of n points. Points are handled in runs on the same
+        // tile, with one tile lookup per run, so points along a path, like
+        // the nodes of a way, are best passed in order.
+        void elevations(const double* lat, const double* lon, double* result, size_t n) const;
+
+        // True if (lat, lon) is within the tiles this was created for
+        bool contains(double lat, double lon) const;
+        // Edges of the area the tiles cover, in degrees
+        double getSouth() const { return south; }
+        double getWest() const { return west; }
+        double getNorth() const { return north + 1; }
+        double getEast() const { return east + 1; }
+        // Distance between samples, in degrees
+        double resolution() const;
 
     private:
-        double getTileValue(int8_t* tile, int index);
+        void loadTile(int i, const string& filePath);
+        // Waits until tile i is read
+        void waitFor(int i) const;
+        double getTileValue(int8_t* tile, int index) const;
+        // Clamps (lat, lon) to the tiles, returning the index of its tile
+        int clampToTile(double& lat, double& lon) const;
+        // Bilinear interpolation in a tile that is read
+        double interpolate(int tileIndex, double lat, double lon) const;
     };
 }
 
@@ -0,0 +1,303 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include "highways.hxx"
+
+using namespace std;
+
+namespace osmwave {
+    // Longest ribbon segment between height samples, in meters
+    const double MAX_SEGMENT_LENGTH = 10.0;
+    // Ribbons are lifted slightly to not fight with the terrain surface
+    const double RIBBON_LIFT = 0.15;
+    const double METERS_PER_DEGREE = 111320.0;
+
+    static double default_width(const char* highway) {
+        static const struct {
+            const char* type;
+            double width;
+        } widths[] = {
+            {"motorway", 12}, {"trunk", 10}, {"primary", 8}, {"secondary", 7},
+            {"tertiary", 6}, {"unclassified", 5}, {"residential", 5}, {"living_street", 4},
+            {"motorway_link", 5}, {"trunk_link", 5}, {"primary_link", 5}, {"secondary_link", 5},
+            {"tertiary_link", 5}, {"service", 3}, {"track", 3}, {"pedestrian", 4},
+            {"cycleway", 2}, {"footway", 2}, {"path", 1.5}, {"steps", 2}, {"bridleway", 2}
+        };
+
+        for (auto& w : widths) {
+            if (!strcmp(highway, w.type)) {
+                return w.width;
+            }
+        }
+
+        return 4;
+    }
+
+    static bool is_linear_road(const char* highway) {
+        static const char* ignored[] = {
+            "proposed", "construction", "abandoned", "razed", "platform", "bus_stop", "elevator", "corridor"
+        };
+
+        for (auto type : ignored) {
+            if (!strcmp(highway, type)) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    // Value of the highway tag of ways built as ribbons, otherwise null
+    static const char* ribbon_highway(const osmium::Way& way) {
+        const osmium::TagList& tags = way.tags();
+        const char* highway = tags.get_value_by_key("highway");
+        const char* area = tags.get_value_by_key("area");
+
+        if (!highway || !is_linear_road(highway) || (area && !strcmp(area, "yes")) || way.nodes().size() < 2) {
+            return nullptr;
+        }
+
+        return highway;
+    }
+
+    void JunctionFinder::way(const osmium::Way& way) {
+        if (ribbon_highway(way)) {
+            for (auto& nr : way.nodes()) {
+                if (nr.ref() > 0 && seen.check_and_set(nr.ref())) {
+                    seenTwice.set(nr.ref());
+                }
+            }
+        }
+    }
+
+    vector<osmium::object_id_type> JunctionFinder::junctions() {
+        seen.clear();
+
+        vector<osmium::object_id_type> result;
+        result.reserve(seenTwice.size());
+        for (auto id : seenTwice) {
+            result.push_back(id);
+        }
+
+        seenTwice.clear();
+        return result;
+    }
+
+    HighwayHandler::HighwayHandler(const Projection& projection, const LocalFrame& frame, ObjWriter& writer, const Elevation& elevation, const Clip* clip, BackgroundTerrain* terrain,
+        vector<osmium::object_id_type>&& junctions) :
+        projection(projection), frame(frame), writer(writer), elevation(elevation), clip(clip), terrain(terrain), junctions(move(junctions)),
+        junctionVertices(this->junctions.size(), -1) {
+    }
+
+    void HighwayHandler::way(const osmium::Way& way) {
+        const osmium::TagList& tags = way.tags();
+        const char* highway = ribbon_highway(way);
+        if (!highway) {
+            return;
+        }
+
+        if (clip && !inClip(way)) {
+            return;
+        }
+
+        double width = default_width(highway);
+        const char* widthTag = tags.get_value_by_key("width");
+        if (widthTag) {
+            char* end;
+            double parsed = strtod(widthTag, &end);
+            if (end != widthTag && parsed > 0) {
+                width = parsed;
+            }
+        }
+
+        densify(way.nodes());
+        if (lats.size() < 2) {
+            return;
+        }
+
+        projection.forward(coords.data(), lats.size());
+        for (size_t i = 0; i < coords.size(); i += 2) {
+            coords[i] -= frame.originX;
+            coords[i + 1] -= frame.originY;
+        }
+        offsetEdges(width);
+        sampleHeights();
+        writeRibbon();
+    }
+
+    bool HighwayHandler::inClip(const osmium::Way& way) {
+        osmium::Box box = way.envelope();
+        if (!box.valid() || !clip->intersects(box.bottom_left().lon(), box.bottom_left().lat(), box.top_right().lon(), box.top_right().lat())) {
+            return false;
+        }
+
+        if (!clip->hasPolygon()) {
+            return true;
+        }
+
+        // The coordinates scratch buffer is refilled by densify
+        coords.clear();
+        for (auto& nr : way.nodes()) {
+            if (nr.location().valid()) {
+                coords.push_back(nr.lon());
+                coords.push_back(nr.lat());
+            }
+        }
+
+        return clip->intersectsPath(coords.data(), coords.size() / 2, false);
+    }
+
+    // Fills the scratch buffers with the way's nodes, plus evenly spaced
+    // points on segments longer than MAX_SEGMENT_LENGTH. Points that are not
+    // OSM nodes get node id 0.
+    void HighwayHandler::densify(const osmium::WayNodeList& nodes) {
+        coords.clear();
+        lats.clear();
+        lons.clear();
+        nodeIds.clear();
+
+        double lastLat = 0, lastLon = 0;
+        for (auto& nr : nodes) {
+            if (!nr.location().valid()) {
+                continue;
+            }
+
+            double lat = nr.lat();
+            double lon = nr.lon();
+            if (!lats.empty()) {
+                double dy = (lat - lastLat) * METERS_PER_DEGREE;
+                double dx = (lon - lastLon) * METERS_PER_DEGREE * cos(lat * DEG_TO_RAD);
+                int steps = (int)ceil(sqrt(dx * dx + dy * dy) / MAX_SEGMENT_LENGTH);
+                if (steps == 0) {
+                    // Duplicate location
+                    continue;
+                }
+
+                for (int i = 1; i < steps; i++) {
+                    double t = (double)i / steps;
+                    lats.push_back(lastLat + (lat - lastLat) * t);
+                    lons.push_back(lastLon + (lon - lastLon) * t);
+                    nodeIds.push_back(0);
+                }
+            }
+
+            lats.push_back(lat);
+            lons.push_back(lon);
+            nodeIds.push_back(nr.ref());
+            lastLat = lat;
+            lastLon = lon;
+        }
+
+        for (size_t i = 0; i < lats.size(); i++) {
+            coords.push_back(lons[i] * DEG_TO_RAD);
+            coords.push_back(lats[i] * DEG_TO_RAD);
+        }
+    }
+
+    // Offsets every point by half the width to both sides, along the
+    // normal of the averaged direction of the adjacent segments
+    void HighwayHandler::offsetEdges(double width) {
+        size_t n = lats.size();
+        double halfWidth = width / 2;
+
+        edges.resize(n * 4);
+        for (size_t i = 0; i < n; i++) {
+            size_t prev = i > 0 ? i - 1 : i;
+            size_t next = i < n - 1 ? i + 1 : i;
+            double dx = coords[next * 2] - coords[prev * 2];
+            double dy = coords[next * 2 + 1] - coords[prev * 2 + 1];
+            double l = sqrt(dx * dx + dy * dy);
+            double ox = l > 0 ? -dy / l * halfWidth : 0;
+            double oy = l > 0 ? dx / l * halfWidth : 0;
+
+            edges[i * 4] = coords[i * 2] + ox;
+            edges[i * 4 + 1] = coords[i * 2 + 1] + oy;
+            edges[i * 4 + 2] = coords[i * 2] - ox;
+            edges[i * 4 + 3] = coords[i * 2 + 1] - oy;
+        }
+    }
+
+    // Heights of the centerline and both edges, in one batch, in path order
+    void HighwayHandler::sampleHeights() {
+        size_t n = lats.size();
+        sampleCoords.resize(n * 6);
+        for (size_t i = 0; i < n; i++) {
+            sampleCoords[i * 6] = coords[i * 2];
+            sampleCoords[i * 6 + 1] = coords[i * 2 + 1];
+            for (int k = 0; k < 4; k++) {
+                sampleCoords[i * 6 + 2 + k] = edges[i * 4 + k];
+            }
+        }
+
+        // Edge positions are only known projected; take them back to lat/lng
+        size_t m = n * 3;
+        sampleLats.resize(m);
+        sampleLons.resize(m);
+        for (size_t i = 0; i < m; i++) {
+            sampleCoords[i * 2] += frame.originX;
+            sampleCoords[i * 2 + 1] += frame.originY;
+        }
+        projection.inverse(sampleCoords.data(), m);
+        for (size_t i = 0; i < m; i++) {
+            sampleLons[i] = sampleCoords[i * 2] / DEG_TO_RAD;
+            sampleLats[i] = sampleCoords[i * 2 + 1] / DEG_TO_RAD;
+        }
+
+        heights.resize(m);
+        elevation.elevations(sampleLats.data(), sampleLons.data(), heights.data(), m);
+
+        if (terrain) {
+            for (size_t i = 0; i < n; i++) {
+                terrain->height(writer, coords[i * 2], coords[i * 2 + 1], heights[i * 3]);
+                terrain->height(writer, edges[i * 4], edges[i * 4 + 1], heights[i * 3 + 1]);
+                terrain->height(writer, edges[i * 4 + 2], edges[i * 4 + 3], heights[i * 3 + 2]);
+            }
+        }
+    }
+
+    void HighwayHandler::writeRibbon() {
+        size_t n = lats.size();
+
+        left.resize(n);
+        center.resize(n);
+        right.resize(n);
+
+        for (size_t i = 0; i < n; i++) {
+            double x = coords[i * 2];
+            double y = coords[i * 2 + 1];
+            double z = heights[i * 3] + RIBBON_LIFT;
+
+            osmium::object_id_type id = nodeIds[i];
+            auto junction = id ? lower_bound(junctions.begin(), junctions.end(), id) : junctions.end();
+            if (junction != junctions.end() && *junction == id) {
+                int& shared = junctionVertices[junction - junctions.begin()];
+                if (shared < 0) {
+                    shared = writer.vertex(y, z, x);
+                }
+                center[i] = shared;
+            } else {
+                center[i] = writer.vertex(y, z, x);
+            }
+
+            left[i] = writer.vertex(edges[i * 4 + 1], heights[i * 3 + 1] + RIBBON_LIFT, edges[i * 4]);
+            right[i] = writer.vertex(edges[i * 4 + 3], heights[i * 3 + 2] + RIBBON_LIFT, edges[i * 4 + 2]);
+        }
+
+        writer.clearCheckpoint();
+        for (size_t i = 0; i + 1 < n; i++) {
+            writer.beginFace();
+            writer << left[i] << center[i] << center[i + 1];
+            writer.endFace();
+            writer.beginFace();
+            writer << left[i] << center[i + 1] << left[i + 1];
+            writer.endFace();
+            writer.beginFace();
+            writer << center[i] << right[i] << right[i + 1];
+            writer.endFace();
+            writer.beginFace();
+            writer << center[i] << right[i + 1] << center[i + 1];
+            writer.endFace();
+        }
+    }
+}
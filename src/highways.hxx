@@ -0,0 +1,84 @@
+#ifndef __HIGHWAYS_HXX__
+#define __HIGHWAYS_HXX__
+
+#include <vector>
+#include <osmium/handler.hpp>
+#include <osmium/index/id_set.hpp>
+#include <osmium/osm/way.hpp>
+#include "ObjWriter.hxx"
+#include "elevation.hxx"
+#include "clip.hxx"
+#include "terrainmesh.hxx"
+#include "localframe.hxx"
+#include "projection.hxx"
+
+using namespace std;
+
+namespace osmwave {
+    // Collects the nodes where highway ribbons join, in a pass over the
+    // ways before the one that builds them: nodes used more than once by
+    // the ways HighwayHandler builds. Node ids are kept in two bit sets,
+    // seen once and seen again, so memory grows with the highest node id,
+    // at two bits per id, rather than with the number of node refs.
+    // Negative ids, only found in unsaved edits, are never junctions.
+    class JunctionFinder : public osmium::handler::Handler {
+        osmium::index::IdSetDense<osmium::unsigned_object_id_type> seen;
+        osmium::index::IdSetDense<osmium::unsigned_object_id_type> seenTwice;
+
+    public:
+        void way(const osmium::Way& way);
+
+        // Sorted ids of the junction nodes; frees the bit sets
+        vector<osmium::object_id_type> junctions();
+    };
+
+    // Builds ribbon meshes for linear highway=* ways, draped on the ground.
+    // Ways are densified so the ribbon follows the terrain between nodes,
+    // with the height sampled at both edges as well as the centerline, and
+    // the centerline vertex of every junction node is shared between
+    // all ways passing through it, which connects ribbons at junctions.
+    class HighwayHandler : public osmium::handler::Handler {
+        const Projection& projection;
+        const LocalFrame& frame;
+        ObjWriter& writer;
+        const Elevation& elevation;
+        const Clip* clip;
+        BackgroundTerrain* terrain;
+        // Sorted junction node ids, and their centerline vertex index once
+        // written, or -1
+        vector<osmium::object_id_type> junctions;
+        vector<int> junctionVertices;
+
+        // Scratch buffers for the way being built, reused between ways
+        vector<double> coords;
+        vector<double> lats;
+        vector<double> lons;
+        // Left and right edge positions, projected, of every point
+        vector<double> edges;
+        // Positions heights are sampled at, three per point: centerline,
+        // left and right edge
+        vector<double> sampleCoords;
+        vector<double> sampleLats;
+        vector<double> sampleLons;
+        vector<double> heights;
+        vector<osmium::object_id_type> nodeIds;
+        vector<int> left;
+        vector<int> center;
+        vector<int> right;
+
+    public:
+        HighwayHandler(const Projection& projection, const LocalFrame& frame, ObjWriter& writer, const Elevation& elevation, const Clip* clip, BackgroundTerrain* terrain,
+            vector<osmium::object_id_type>&& junctions);
+
+        void way(const osmium::Way& way);
+
+    private:
+        bool inClip(const osmium::Way& way);
+        void densify(const osmium::WayNodeList& nodes);
+        void offsetEdges(double width);
+        void sampleHeights();
+        void writeRibbon();
+    };
+}
+
+#endif
@@ -0,0 +1,273 @@
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <queue>
+#include "hilbert.hxx"
+
+using namespace std;
+
+namespace osmwave {
+    // Records start with a header taking this many doubles
+    const size_t HEADER_DOUBLES = 4;
+
+    // Rotates and flips a quadrant, see the Hilbert curve article on Wikipedia
+    static inline void rotate(uint32_t n, uint32_t& x, uint32_t& y, uint32_t rx, uint32_t ry) {
+        if (ry == 0) {
+            if (rx == 1) {
+                x = n - 1 - x;
+                y = n - 1 - y;
+            }
+            swap(x, y);
+        }
+    }
+
+    uint64_t hilbert_key(uint32_t x, uint32_t y, int order) {
+        uint32_t n = 1u << order;
+        uint64_t d = 0;
+        for (uint32_t s = n / 2; s > 0; s /= 2) {
+            uint32_t rx = (x & s) > 0;
+            uint32_t ry = (y & s) > 0;
+            d += (uint64_t)s * s * ((3 * rx) ^ ry);
+            rotate(n, x, y, rx, ry);
+        }
+
+        return d;
+    }
+
+    void hilbert_cell(uint64_t key, int order, uint32_t& x, uint32_t& y) {
+        uint32_t n = 1u << order;
+        x = y = 0;
+        for (uint32_t s = 1; s < n; s *= 2) {
+            uint32_t rx = 1 & (uint32_t)(key / 2);
+            uint32_t ry = 1 & (uint32_t)(key ^ rx);
+            rotate(s, x, y, rx, ry);
+            x += s * rx;
+            y += s * ry;
+            key /= 4;
+        }
+    }
+
+    HilbertSorter::HilbertSorter(RingSink& next, double minX, double minY, double maxX, double maxY, size_t runBytes) :
+        next(next), minX(minX), minY(minY), runBytes(runBytes), count(0),
+        index(nullptr), writer(nullptr), counter(nullptr), compressor(nullptr), inChunk(false), chunk(0), chunkOffset(0), chunkFirstVertex(0), chunkBuildings(0) {
+        cellWidth = max(maxX - minX, 1e-6) / (1 << HILBERT_ORDER);
+        cellHeight = max(maxY - minY, 1e-6) / (1 << HILBERT_ORDER);
+    }
+
+    HilbertSorter::~HilbertSorter() {
+        for (FILE* run : runs) {
+            fclose(run);
+        }
+    }
+
+    void HilbertSorter::setIndex(ostream& index, ObjWriter& writer, CountingStreambuf& counter, CompressingStreambuf* compressor) {
+        this->index = &index;
+        this->writer = &writer;
+        this->counter = &counter;
+        this->compressor = compressor;
+
+        // Horizontal bounds in OBJ axes, like the instances sidecar
+        index << "# chunk,min_x,min_z,max_x,max_z,offset,length,first_vertex,last_vertex,buildings\n";
+    }
+
+    void HilbertSorter::ring(const double* coords, int nVerts, double elevation, double height) {
+        // Closing vertex is left out of the centroid
+        int n = max(nVerts - 1, 1);
+        double cx = 0, cy = 0;
+        for (int i = 0; i < n; i++) {
+            cx += coords[i * 2];
+            cy += coords[i * 2 + 1];
+        }
+        cx /= n;
+        cy /= n;
+
+        const double maxCell = (1 << HILBERT_ORDER) - 1;
+        uint32_t x = (uint32_t)min(max((cx - minX) / cellWidth, 0.0), maxCell);
+        uint32_t y = (uint32_t)min(max((cy - minY) / cellHeight, 0.0), maxCell);
+
+        static_assert(sizeof(Header) == HEADER_DOUBLES * sizeof(double), "unexpected record header size");
+        Header header = {hilbert_key(x, y, HILBERT_ORDER), elevation, height, nVerts};
+        size_t offset = data.size();
+        data.resize(offset + HEADER_DOUBLES + nVerts * 2);
+        memcpy(&data[offset], &header, sizeof(header));
+        memcpy(&data[offset + HEADER_DOUBLES], coords, nVerts * 2 * sizeof(double));
+        records.push_back(make_pair(header.key, offset));
+        count++;
+
+        if (data.size() * sizeof(double) + records.size() * sizeof(records[0]) >= runBytes) {
+            sortRun();
+            if (!spill()) {
+                // Keep going in memory; the output is still ordered, just
+                // without a bound on memory
+                runBytes = numeric_limits<size_t>::max();
+            }
+        }
+    }
+
+    bool HilbertSorter::finish() {
+        // The last run is merged from memory, without spilling it
+        sortRun();
+        bool complete = merge();
+        endChunk();
+
+        cerr << "Ordered " << count << " buildings along a Hilbert curve";
+        if (!runs.empty()) {
+            cerr << ", merging " << runs.size() << " runs";
+        }
+        cerr << endl;
+
+        records.clear();
+        data.clear();
+        return next.finish() && complete;
+    }
+
+    // Stable, so that equal keys keep the order they arrived in
+    void HilbertSorter::sortRun() {
+        stable_sort(records.begin(), records.end(), [](const pair<uint64_t, size_t>& a, const pair<uint64_t, size_t>& b) {
+            return a.first < b.first;
+        });
+    }
+
+    bool HilbertSorter::spill() {
+        FILE* file = tmpfile();
+        if (!file) {
+            return false;
+        }
+
+        for (auto& record : records) {
+            const double* start = &data[record.second];
+            Header header;
+            memcpy(&header, start, sizeof(header));
+            size_t n = HEADER_DOUBLES + header.nVerts * 2;
+            if (fwrite(start, sizeof(double), n, file) != n) {
+                fclose(file);
+                return false;
+            }
+        }
+
+        if (fflush(file) != 0) {
+            fclose(file);
+            return false;
+        }
+
+        rewind(file);
+        runs.push_back(file);
+        records.clear();
+        data.clear();
+        return true;
+    }
+
+    bool HilbertSorter::readRecord(Run& run) {
+        if (fread(&run.header, sizeof(run.header), 1, run.file) != 1) {
+            return false;
+        }
+
+        run.coords.resize(run.header.nVerts * 2);
+        return fread(run.coords.data(), sizeof(double), run.coords.size(), run.file) == run.coords.size();
+    }
+
+    // k-way merge of the spilled runs and the sorted run in memory, which
+    // arrived last; ties go to the earlier run, which keeps the order
+    // stable across runs too. Returns false if a spilled run could not be
+    // read back in full.
+    bool HilbertSorter::merge() {
+        vector<Run> sources(runs.size());
+        typedef pair<uint64_t, size_t> Entry;
+        priority_queue<Entry, vector<Entry>, greater<Entry>> heads;
+
+        for (size_t i = 0; i < runs.size(); i++) {
+            sources[i].file = runs[i];
+            if (readRecord(sources[i])) {
+                heads.push(make_pair(sources[i].header.key, i));
+            }
+        }
+
+        const size_t memory = runs.size();
+        size_t nextRecord = 0;
+        if (!records.empty()) {
+            heads.push(make_pair(records[0].first, memory));
+        }
+
+        Header header;
+        while (!heads.empty()) {
+            size_t i = heads.top().second;
+            heads.pop();
+
+            if (i == memory) {
+                size_t offset = records[nextRecord].second;
+                memcpy(&header, &data[offset], sizeof(header));
+                emit(header, &data[offset + HEADER_DOUBLES]);
+                if (++nextRecord < records.size()) {
+                    heads.push(make_pair(records[nextRecord].first, memory));
+                }
+                continue;
+            }
+
+            Run& run = sources[i];
+            emit(run.header, run.coords.data());
+            if (readRecord(run)) {
+                heads.push(make_pair(run.header.key, i));
+            }
+        }
+
+        bool complete = true;
+        for (FILE* run : runs) {
+            if (ferror(run) || !feof(run)) {
+                complete = false;
+            }
+        }
+        if (!complete) {
+            cerr << "Unable to read back buildings from a temporary file; output is incomplete." << endl;
+        }
+        return complete;
+    }
+
+    void HilbertSorter::emit(const Header& header, const double* coords) {
+        if (index) {
+            uint64_t recordChunk = header.key >> (2 * (HILBERT_ORDER - HILBERT_CHUNK_ORDER));
+            if (!inChunk || recordChunk != chunk) {
+                endChunk();
+                inChunk = true;
+                chunk = recordChunk;
+                chunkOffset = outputPosition();
+                chunkFirstVertex = writer->nextVertex();
+                chunkBuildings = 0;
+            }
+            chunkBuildings++;
+        }
+
+        next.ring(coords, header.nVerts, header.elevation, header.height);
+    }
+
+    void HilbertSorter::endChunk() {
+        if (!inChunk) {
+            return;
+        }
+        inChunk = false;
+
+        // Buildings may be held back by the writer
+        next.flush();
+
+        uint32_t cx, cy;
+        hilbert_cell(chunk, HILBERT_CHUNK_ORDER, cx, cy);
+        double size = 1 << (HILBERT_ORDER - HILBERT_CHUNK_ORDER);
+        double x1 = minX + cx * size * cellWidth, y1 = minY + cy * size * cellHeight;
+        double x2 = x1 + size * cellWidth, y2 = y1 + size * cellHeight;
+
+        *index << chunk << ',' << y1 << ',' << x1 << ',' << y2 << ',' << x2 << ',' <<
+            chunkOffset << ',' << (outputPosition() - chunkOffset) << ',' <<
+            chunkFirstVertex << ',' << (writer->nextVertex() - 1) << ',' << chunkBuildings << '\n';
+    }
+
+    // With compression, syncing ends the compressor's block and writes out
+    // everything before it, so the position is a block boundary
+    uint64_t HilbertSorter::outputPosition() {
+        if (!compressor) {
+            return counter->position();
+        }
+
+        counter->pubsync();
+        return compressor->position();
+    }
+}
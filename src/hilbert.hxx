@@ -0,0 +1,104 @@
+#ifndef __HILBERT_HXX__
+#define __HILBERT_HXX__
+
+#include <cstdint>
+#include <cstdio>
+#include <ostream>
+#include <utility>
+#include <vector>
+#include "buildings.hxx"
+#include "ObjWriter.hxx"
+#include "outputstream.hxx"
+
+using namespace std;
+
+namespace osmwave {
+    // Bits per axis of the grid buildings are ordered on
+    const int HILBERT_ORDER = 16;
+    // Bits per axis of the grid of chunks listed in the index
+    const int HILBERT_CHUNK_ORDER = 6;
+
+    // Distance along the Hilbert curve of cell (x, y) in a grid of
+    // 2^order cells per axis. The key of a cell shifted right by
+    // 2 * (order - o) is the key of its parent cell in the grid of order o.
+    uint64_t hilbert_key(uint32_t x, uint32_t y, int order);
+
+    // Cell at distance key along the Hilbert curve, inverse of hilbert_key
+    void hilbert_cell(uint64_t key, int order, uint32_t& x, uint32_t& y);
+
+    // Passes rings on to the next sink ordered by the Hilbert key of their
+    // centroid within the box (minX, minY) - (maxX, maxY), so that
+    // buildings close to each other end up close in the output.
+    //
+    // Rings are collected in runs of about runBytes; full runs are sorted
+    // and spilled to temporary files, and merged with the last run, still
+    // in memory, when finished, which keeps memory bounded however many
+    // buildings there are. If a run cannot be spilled, it stays in memory.
+    //
+    // With an index, a line is written for every non-empty chunk of the
+    // chunk grid, with its bounds, the byte range of its buildings in the
+    // output and their vertex index range. With compressed output, every
+    // chunk starts a new block of the compressor, and the byte range is in
+    // the compressed output, so it can be decompressed on its own.
+    class HilbertSorter : public RingSink {
+        struct Header {
+            uint64_t key;
+            double elevation;
+            double height;
+            int64_t nVerts;
+        };
+
+        struct Run {
+            FILE* file;
+            Header header;
+            vector<double> coords;
+        };
+
+        RingSink& next;
+        double minX;
+        double minY;
+        double cellWidth;
+        double cellHeight;
+        size_t runBytes;
+
+        // The run being collected, as headers followed by coordinates,
+        // and the key and offset of each record
+        vector<double> data;
+        vector<pair<uint64_t, size_t>> records;
+        vector<FILE*> runs;
+        size_t count;
+
+        ostream* index;
+        ObjWriter* writer;
+        CountingStreambuf* counter;
+        CompressingStreambuf* compressor;
+        bool inChunk;
+        uint64_t chunk;
+        uint64_t chunkOffset;
+        int chunkFirstVertex;
+        size_t chunkBuildings;
+
+    public:
+        HilbertSorter(RingSink& next, double minX, double minY, double maxX, double maxY, size_t runBytes = 64 << 20);
+        ~HilbertSorter();
+
+        // Writes the chunk index; byte offsets are positions in counter,
+        // which must be the buffer that writer's stream writes to, or in
+        // compressor if set, which counter must then write to
+        void setIndex(ostream& index, ObjWriter& writer, CountingStreambuf& counter, CompressingStreambuf* compressor = nullptr);
+
+        void ring(const double* coords, int nVerts, double elevation, double height);
+        bool finish();
+
+    private:
+        void sortRun();
+        bool spill();
+        bool merge();
+        bool readRecord(Run& run);
+        void emit(const Header& header, const double* coords);
+        void endChunk();
+        uint64_t outputPosition();
+    };
+}
+
+#endif
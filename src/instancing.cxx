@@ -0,0 +1,154 @@
+#include <cmath>
+#include <iostream>
+#include <algorithm>
+#include "instancing.hxx"
+
+using namespace std;
+
+namespace osmwave {
+    size_t BuildingInstancer::KeyHash::operator()(const vector<int32_t>& key) const {
+        // FNV-1a over the quantized values
+        uint64_t hash = 14695981039346656037ULL;
+        for (int32_t v : key) {
+            hash ^= (uint32_t)v;
+            hash *= 1099511628211ULL;
+        }
+
+        return hash;
+    }
+
+    BuildingInstancer::BuildingInstancer(ObjWriter& prototypeWriter, ostream& sidecar, RingSink& next, double quantum) :
+        prototypeWriter(prototypeWriter), sidecar(sidecar), next(next), quantum(quantum) {
+    }
+
+    void BuildingInstancer::ring(const double* coords, int nVerts, double elevation, double height) {
+        // Closing vertex is left out of the canonical form
+        int n = nVerts - 1;
+        if (n < 3) {
+            next.ring(coords, nVerts, elevation, height);
+            return;
+        }
+
+        double cx = 0, cy = 0;
+        for (int i = 0; i < n; i++) {
+            cx += coords[i * 2];
+            cy += coords[i * 2 + 1];
+        }
+        cx /= n;
+        cy /= n;
+
+        double angle = 0;
+        int start = 0;
+        canonicalKey(coords, n, cx, cy, height, angle, start);
+
+        Transform transform = {cx, cy, elevation, angle};
+        auto found = index.find(key);
+        if (found == index.end()) {
+            found = index.insert(make_pair(key, prototypes.size())).first;
+            Prototype prototype;
+            prototype.key = &found->first;
+            prototype.first = transform;
+            prototypes.push_back(move(prototype));
+            return;
+        }
+
+        prototypes[found->second].more.push_back(transform);
+    }
+
+    // Tries every edge about as long as the longest one as the x axis, and
+    // keeps the one giving the lexicographically smallest quantized ring;
+    // that makes the choice independent of the ring's rotation and start.
+    void BuildingInstancer::canonicalKey(const double* coords, int n, double cx, double cy, double height, double& angle, int& start) {
+        double maxLength = 0;
+        for (int i = 0; i < n; i++) {
+            double dx = coords[(i + 1) * 2] - coords[i * 2], dy = coords[(i + 1) * 2 + 1] - coords[i * 2 + 1];
+            maxLength = max(maxLength, sqrt(dx * dx + dy * dy));
+        }
+
+        key.clear();
+        for (int i = 0; i < n; i++) {
+            double dx = coords[(i + 1) * 2] - coords[i * 2], dy = coords[(i + 1) * 2 + 1] - coords[i * 2 + 1];
+            if (sqrt(dx * dx + dy * dy) < maxLength - quantum) {
+                continue;
+            }
+
+            double a = atan2(dy, dx);
+            double c = cos(-a), s = sin(-a);
+            candidate.clear();
+            candidate.push_back(n);
+            candidate.push_back((int32_t)lround(height / quantum));
+            for (int k = 0; k < n; k++) {
+                int j = (i + k) % n;
+                double x = coords[j * 2] - cx, y = coords[j * 2 + 1] - cy;
+                candidate.push_back((int32_t)lround((x * c - y * s) / quantum));
+                candidate.push_back((int32_t)lround((x * s + y * c) / quantum));
+            }
+
+            if (key.empty() || candidate < key) {
+                key.swap(candidate);
+                angle = a;
+                start = i;
+            }
+        }
+    }
+
+    void BuildingInstancer::placeKey(const vector<int32_t>& key, const Transform& transform) {
+        // The key holds the vertex count, the height and the ring
+        int n = key[0];
+        double c = cos(transform.angle), s = sin(transform.angle);
+        coords.clear();
+        for (int i = 0; i <= n; i++) {
+            int j = i % n;
+            double x = key[2 + j * 2] * quantum, y = key[3 + j * 2] * quantum;
+            coords.push_back(transform.x + x * c - y * s);
+            coords.push_back(transform.y + x * s + y * c);
+        }
+    }
+
+    bool BuildingInstancer::finish() {
+        // Coordinates in the sidecar use the OBJ axes: x is projected
+        // northing, y is up and z is projected easting. A rotation by angle
+        // around y maps the prototype onto the instance.
+        sidecar << "# group,x,y,z,rotation\n";
+        RingWriter ringWriter(prototypeWriter);
+        Transform origin = {0, 0, 0, 0};
+        size_t groupId = 0;
+        size_t instances = 0;
+        for (auto& prototype : prototypes) {
+            const vector<int32_t>& key = *prototype.key;
+            int n = key[0];
+            double height = key[1] * quantum;
+            if (prototype.more.empty()) {
+                const Transform& t = prototype.first;
+                placeKey(key, t);
+                next.ring(coords.data(), n + 1, t.z, height);
+                continue;
+            }
+
+            string group = "proto_" + to_string(++groupId);
+            prototypeWriter.group(group);
+            placeKey(key, origin);
+            ringWriter.ring(coords.data(), n + 1, 0, height);
+
+            auto place = [this, &group](const Transform& t) {
+                sidecar << group << ',' << t.y << ',' << t.z << ',' << t.x << ',' << t.angle << '\n';
+            };
+            place(prototype.first);
+            for (auto& t : prototype.more) {
+                place(t);
+            }
+            instances += prototype.more.size() + 1;
+        }
+        ringWriter.finish();
+        sidecar.flush();
+        bool ok = next.finish();
+
+        cerr << groupId << " repeated building shapes with " << instances << " instances" << endl;
+
+        if (!sidecar) {
+            cerr << "Unable to write the instances file" << endl;
+            return false;
+        }
+        return ok;
+    }
+}
@@ -0,0 +1,71 @@
+#ifndef __INSTANCING_HXX__
+#define __INSTANCING_HXX__
+
+#include <cstdint>
+#include <ostream>
+#include <unordered_map>
+#include <vector>
+#include "buildings.hxx"
+#include "ObjWriter.hxx"
+
+using namespace std;
+
+namespace osmwave {
+    // Finds buildings with the same footprint up to translation and
+    // rotation, and the same height. Each footprint is moved to its
+    // centroid, rotated so that its longest edge lies along the x axis and
+    // quantized, which gives a key that is equal for repeated shapes.
+    //
+    // Only the keys and the placements are kept in memory. When finished,
+    // every repeated shape is written once, around the origin, as an OBJ
+    // group named proto_<n> to the prototypes writer, and every one of
+    // its occurrences becomes a line in the sidecar with the group name,
+    // translation and rotation around the up axis. Shapes found only once
+    // are passed on to the next sink, rebuilt from their key, so their
+    // vertices and height are rounded to the quantum.
+    class BuildingInstancer : public RingSink {
+        struct Transform {
+            double x;
+            double y;
+            double z;
+            double angle;
+        };
+
+        struct Prototype {
+            // Key in the index, which is the quantized canonical ring
+            const vector<int32_t>* key;
+            Transform first;
+            // Occurrences after the first
+            vector<Transform> more;
+        };
+
+        struct KeyHash {
+            size_t operator()(const vector<int32_t>& key) const;
+        };
+
+        ObjWriter& prototypeWriter;
+        ostream& sidecar;
+        RingSink& next;
+        double quantum;
+        unordered_map<vector<int32_t>, size_t, KeyHash> index;
+        vector<Prototype> prototypes;
+
+        // Scratch buffers, reused between rings
+        vector<int32_t> key;
+        vector<int32_t> candidate;
+        vector<double> coords;
+
+    public:
+        BuildingInstancer(ObjWriter& prototypeWriter, ostream& sidecar, RingSink& next, double quantum = 0.1);
+
+        void ring(const double* coords, int nVerts, double elevation, double height);
+        bool finish();
+
+    private:
+        void canonicalKey(const double* coords, int n, double cx, double cy, double height, double& angle, int& start);
+        // Fills coords with the closed ring of key, placed by transform
+        void placeKey(const vector<int32_t>& key, const Transform& transform);
+    };
+}
+
+#endif
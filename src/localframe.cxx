@@ -0,0 +1,56 @@
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+#include "localframe.hxx"
+
+using namespace std;
+
+namespace osmwave {
+    string LocalFrame::comment() const {
+        ostringstream c;
+        c.precision(12);
+        c << "Local origin: (" << originX << ", " << originY << "), single precision";
+        return c.str();
+    }
+
+    LocalFrame LocalFrame::forBounds(const Projection& projection, double west, double south, double east, double north, bool single) {
+        LocalFrame frame;
+        if (!single) {
+            return frame;
+        }
+
+        // Corners and edge midpoints, since the projected box may bulge
+        double lons[] = {west, east, west, east, (west + east) / 2, (west + east) / 2, west, east, (west + east) / 2};
+        double lats[] = {south, south, north, north, south, north, (south + north) / 2, (south + north) / 2, (south + north) / 2};
+        const int n = 9;
+        double coords[n * 2];
+        for (int i = 0; i < n; i++) {
+            coords[i * 2] = lons[i] * DEG_TO_RAD;
+            coords[i * 2 + 1] = lats[i] * DEG_TO_RAD;
+        }
+        projection.forward(coords, n);
+
+        frame.originX = coords[(n - 1) * 2];
+        frame.originY = coords[(n - 1) * 2 + 1];
+
+        double extent = 0;
+        for (int i = 0; i < n - 1; i++) {
+            extent = max(extent, fabs(coords[i * 2] - frame.originX));
+            extent = max(extent, fabs(coords[i * 2 + 1] - frame.originY));
+        }
+        // Geometry reaches a bit outside the box
+        extent *= 1.1;
+
+        float f = (float)extent;
+        double error = (nextafterf(f, INFINITY) - f) / 2;
+        if (error > SINGLE_PRECISION_TOLERANCE) {
+            cerr << "Warning! Region extends " << extent << " m from its center, which gives errors of " << error <<
+                " m in single precision; using double precision." << endl;
+            return LocalFrame();
+        }
+
+        frame.single = true;
+        return frame;
+    }
+}
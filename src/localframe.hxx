@@ -0,0 +1,35 @@
+#ifndef __LOCALFRAME_HXX__
+#define __LOCALFRAME_HXX__
+
+#include <string>
+#include "projection.hxx"
+
+namespace osmwave {
+    // Largest rounding error, in meters, accepted for single precision
+    // coordinates
+    const double SINGLE_PRECISION_TOLERANCE = 0.01;
+
+    // Origin that projected coordinates are stored relative to, and whether
+    // they are precise enough in single precision. Without single
+    // precision the origin is the projection's own, which keeps output
+    // coordinates as they have always been.
+    struct LocalFrame {
+        double originX;
+        double originY;
+        bool single;
+
+        LocalFrame() : originX(0), originY(0), single(false) {}
+
+        // Frame for the lat/lng box (west, south) - (east, north). Single
+        // precision is only used if requested, and if the rounding error
+        // anywhere in the box stays within SINGLE_PRECISION_TOLERANCE;
+        // otherwise a warning is printed and double precision is used.
+        static LocalFrame forBounds(const Projection& projection, double west, double south, double east, double north, bool single);
+
+        // Comment written to models in a single precision frame, giving
+        // the origin needed to georeference them
+        std::string comment() const;
+    };
+}
+
+#endif
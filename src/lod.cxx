@@ -0,0 +1,216 @@
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <iterator>
+#include <numeric>
+#include <sstream>
+#include <boost/geometry/index/rtree.hpp>
+#include "lod.hxx"
+#include "ObjWriter.hxx"
+#include "outputstream.hxx"
+#include "parallel.hxx"
+
+using namespace std;
+
+namespace bg = boost::geometry;
+namespace bgi = boost::geometry::index;
+
+namespace osmwave {
+    LodBuilder::LodBuilder(RingSink& next, const vector<double>& thresholds, const string& prefix, const LocalFrame& frame, bool optimize) :
+        next(next), thresholds(thresholds), prefix(prefix), frame(frame), optimize(optimize), count(0) {
+        sort(this->thresholds.begin(), this->thresholds.end());
+    }
+
+    void LodBuilder::ring(const double* coords, int nVerts, double elevation, double height) {
+        Building building;
+        building.shape.outer().reserve(nVerts);
+        for (int i = 0; i < nVerts; i++) {
+            building.shape.outer().push_back(Point(coords[i * 2], coords[i * 2 + 1]));
+        }
+        bg::correct(building.shape);
+        building.elevation = elevation;
+        building.top = elevation + height;
+
+        Box envelope = bg::return_envelope<Box>(building.shape);
+        int64_t cx = (int64_t)floor((envelope.min_corner().x() + envelope.max_corner().x()) / 2 / LOD_CELL_SIZE);
+        int64_t cy = (int64_t)floor((envelope.min_corner().y() + envelope.max_corner().y()) / 2 / LOD_CELL_SIZE);
+        byCell[((uint64_t)(uint32_t)cx << 32) | (uint32_t)cy].push_back(move(building));
+        count++;
+
+        next.ring(coords, nVerts, elevation, height);
+    }
+
+    bool LodBuilder::finish() {
+        if (!next.finish()) {
+            return false;
+        }
+
+        vector<vector<Building>> cells;
+        cells.reserve(byCell.size());
+        for (auto& cell : byCell) {
+            cells.push_back(move(cell.second));
+        }
+        byCell.clear();
+
+        for (size_t level = 0; level < thresholds.size(); level++) {
+            double threshold = thresholds[level];
+            parallel_for(cells.size(), [&cells, threshold](size_t begin, size_t end) {
+                for (size_t i = begin; i < end; i++) {
+                    coarsen(cells[i], threshold);
+                }
+            }, 1);
+
+            ostringstream path;
+            path << prefix << (level + 1) << ".obj";
+            if (!writeLevel(cells, path.str(), threshold)) {
+                return false;
+            }
+
+            size_t blocks = 0;
+            for (auto& cell : cells) {
+                blocks += cell.size();
+            }
+            cerr << "Level of detail " << (level + 1) << " (" << threshold << " m): " << count << " buildings as " << blocks << " blocks" << endl;
+        }
+
+        return true;
+    }
+
+    void LodBuilder::coarsen(vector<Building>& cell, double threshold) {
+        // Union-find over buildings that touch, as long as all roofs of the
+        // merged group stay within the threshold of each other, which
+        // keeps chains of similar roofs from merging very different ones;
+        // invalid footprints are left out, since overlay operations on
+        // them fail
+        vector<size_t> parent(cell.size());
+        iota(parent.begin(), parent.end(), 0);
+        vector<double> minTop(cell.size()), maxTop(cell.size());
+        for (size_t i = 0; i < cell.size(); i++) {
+            minTop[i] = maxTop[i] = cell[i].top;
+        }
+        auto root = [&parent](size_t i) {
+            while (parent[i] != i) {
+                parent[i] = parent[parent[i]];
+                i = parent[i];
+            }
+            return i;
+        };
+
+        typedef pair<Box, size_t> Entry;
+        vector<Entry> entries;
+        for (size_t i = 0; i < cell.size(); i++) {
+            if (bg::is_valid(cell[i].shape)) {
+                entries.push_back(make_pair(bg::return_envelope<Box>(cell[i].shape), i));
+            }
+        }
+
+        bgi::rtree<Entry, bgi::quadratic<16>> tree(entries.begin(), entries.end());
+        vector<Entry> hits;
+        for (auto& entry : entries) {
+            size_t i = entry.second;
+            hits.clear();
+            tree.query(bgi::intersects(entry.first), back_inserter(hits));
+            for (auto& hit : hits) {
+                size_t j = hit.second;
+                if (j <= i) {
+                    continue;
+                }
+
+                size_t a = root(i), b = root(j);
+                double low = min(minTop[a], minTop[b]), high = max(maxTop[a], maxTop[b]);
+                if (a != b && high - low <= threshold && bg::intersects(cell[i].shape, cell[j].shape)) {
+                    parent[a] = b;
+                    minTop[b] = low;
+                    maxTop[b] = high;
+                }
+            }
+        }
+
+        vector<vector<size_t>> groups(cell.size());
+        for (size_t i = 0; i < cell.size(); i++) {
+            groups[root(i)].push_back(i);
+        }
+
+        // Merged blocks get the lowest base and the area weighted mean roof
+        vector<Building> coarse;
+        for (auto& group : groups) {
+            if (group.size() == 1) {
+                coarse.push_back(move(cell[group[0]]));
+            } else if (group.size() > 1) {
+                MultiPolygon merged;
+                double elevation = cell[group[0]].elevation;
+                double area = 0;
+                double volume = 0;
+                for (size_t i : group) {
+                    MultiPolygon next;
+                    bg::union_(merged, cell[i].shape, next);
+                    merged.swap(next);
+
+                    double a = bg::area(cell[i].shape);
+                    area += a;
+                    volume += a * cell[i].top;
+                    elevation = min(elevation, cell[i].elevation);
+                }
+
+                for (auto& shape : merged) {
+                    Building block;
+                    block.shape = move(shape);
+                    block.elevation = elevation;
+                    block.top = area > 0 ? volume / area : cell[group[0]].top;
+                    coarse.push_back(move(block));
+                }
+            }
+        }
+
+        cell.clear();
+        for (auto& building : coarse) {
+            Box envelope = bg::return_envelope<Box>(building.shape);
+            if (max(envelope.max_corner().x() - envelope.min_corner().x(), envelope.max_corner().y() - envelope.min_corner().y()) < threshold) {
+                continue;
+            }
+
+            building.shape.inners().clear();
+            for (double tolerance = threshold; tolerance > threshold / 8; tolerance /= 2) {
+                Polygon simplified;
+                bg::simplify(building.shape, simplified, tolerance);
+                if (simplified.outer().size() >= 4 && bg::is_valid(simplified)) {
+                    building.shape = move(simplified);
+                    break;
+                }
+            }
+
+            cell.push_back(move(building));
+        }
+    }
+
+    bool LodBuilder::writeLevel(const vector<vector<Building>>& cells, const string& path, double threshold) {
+        OutputFile file(path);
+        if (!file.isOpen()) {
+            return false;
+        }
+
+        ObjWriter writer(file.stream());
+        ostringstream c;
+        c << "Level of detail with error threshold " << threshold << " m";
+        writer.comment(c.str());
+        if (frame.single) {
+            writer.comment(frame.comment());
+        }
+
+        RingWriter ringWriter(writer, optimize);
+        vector<double> coords;
+        for (auto& cell : cells) {
+            for (auto& building : cell) {
+                coords.clear();
+                for (auto& point : building.shape.outer()) {
+                    coords.push_back(point.x());
+                    coords.push_back(point.y());
+                }
+                ringWriter.ring(coords.data(), (int)building.shape.outer().size(), building.elevation, building.top - building.elevation);
+            }
+        }
+        ringWriter.finish();
+
+        return file.close();
+    }
+}
@@ -0,0 +1,76 @@
+#ifndef __LOD_HXX__
+#define __LOD_HXX__
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+#include <boost/geometry.hpp>
+#include <boost/geometry/geometries/point_xy.hpp>
+#include <boost/geometry/geometries/polygon.hpp>
+#include <boost/geometry/geometries/multi_polygon.hpp>
+#include <boost/geometry/geometries/box.hpp>
+#include "buildings.hxx"
+#include "localframe.hxx"
+
+using namespace std;
+
+namespace osmwave {
+    // Side of the square cells buildings are grouped in, in meters
+    const double LOD_CELL_SIZE = 500;
+
+    // Passes rings on to the next sink, and when finished writes cheaper
+    // versions of all buildings seen, one model per error threshold, to
+    // <prefix><n>.obj, n counting from 1 for the smallest threshold.
+    //
+    // Every level is built from the one before: touching buildings are
+    // merged into blocks, with courtyards filled in, as long as all roofs
+    // of a block are within the threshold of each other; footprints are simplified by at
+    // most the threshold, and blocks smaller than it are dropped.
+    // Simplification that would make a footprint invalid is retried with
+    // a smaller tolerance, and skipped if that fails too.
+    //
+    // Buildings are grouped by the cell of their centroid as they arrive,
+    // and cells are processed in parallel; blocks never extend across a
+    // cell border. Since any cell may still get buildings until the end,
+    // a copy of every footprint is kept until finished, about as much
+    // memory again as the input buildings' coordinates.
+    class LodBuilder : public RingSink {
+    public:
+        typedef boost::geometry::model::d2::point_xy<double> Point;
+        typedef boost::geometry::model::polygon<Point, false> Polygon;
+        typedef boost::geometry::model::multi_polygon<Polygon> MultiPolygon;
+        typedef boost::geometry::model::box<Point> Box;
+
+    private:
+        struct Building {
+            Polygon shape;
+            double elevation;
+            double top;
+        };
+
+        RingSink& next;
+        vector<double> thresholds;
+        string prefix;
+        LocalFrame frame;
+        bool optimize;
+        // Buildings of each cell, in the order they arrived
+        map<uint64_t, vector<Building>> byCell;
+        size_t count;
+
+    public:
+        // Thresholds in meters, in any order; rings are relative to the
+        // origin of frame, and optimize is passed on to the RingWriter of
+        // each level
+        LodBuilder(RingSink& next, const vector<double>& thresholds, const string& prefix, const LocalFrame& frame, bool optimize = false);
+
+        void ring(const double* coords, int nVerts, double elevation, double height);
+        bool finish();
+
+    private:
+        static void coarsen(vector<Building>& cell, double threshold);
+        bool writeLevel(const vector<vector<Building>>& cells, const string& path, double threshold);
+    };
+}
+
+#endif
@@ -0,0 +1,132 @@
+#include <iostream>
+#include "mergedinput.hxx"
+
+using namespace std;
+
+namespace osmwave {
+    // Merged objects are passed on in buffers of about this size
+    const size_t MERGED_BUFFER_SIZE = 1 << 20;
+
+    MergedInput::MergedInput(const vector<string>& paths, osmium::osm_entity_bits::type entities) :
+        started(false), closed(false), duplicates(0) {
+        sources.resize(paths.size());
+        for (size_t i = 0; i < paths.size(); i++) {
+            Source& source = sources[i];
+            source.path = paths[i];
+            source.reader.reset(new osmium::io::Reader(osmium::io::File(paths[i]), entities));
+            source.done = false;
+            source.unsorted = false;
+            source.lastType = osmium::item_type::undefined;
+            source.lastId = 0;
+        }
+    }
+
+    MergedInput::~MergedInput() {
+        close();
+    }
+
+    bool MergedInput::bounds(osmium::Box& box) {
+        bool found = false;
+        for (auto& source : sources) {
+            for (auto& fileBox : source.reader->header().boxes()) {
+                box.extend(fileBox);
+                found = true;
+            }
+        }
+
+        return found;
+    }
+
+    osmium::memory::Buffer MergedInput::read() {
+        if (sources.size() == 1) {
+            return sources[0].reader->read();
+        }
+
+        if (!started) {
+            started = true;
+            for (auto& source : sources) {
+                advance(source);
+            }
+        }
+
+        osmium::memory::Buffer merged(MERGED_BUFFER_SIZE, osmium::memory::Buffer::auto_grow::yes);
+        while (merged.committed() < MERGED_BUFFER_SIZE) {
+            Source* first = nullptr;
+            for (auto& source : sources) {
+                if (!source.done && (!first ||
+                    source.it->type() < first->it->type() ||
+                    (source.it->type() == first->it->type() && source.it->id() < first->it->id()))) {
+                    first = &source;
+                }
+            }
+
+            if (!first) {
+                break;
+            }
+
+            // Ties in version go to the file given first
+            osmium::item_type type = first->it->type();
+            osmium::object_id_type id = first->it->id();
+            Source* newest = first;
+            for (auto& source : sources) {
+                if (&source != first && !source.done && source.it->type() == type && source.it->id() == id) {
+                    duplicates++;
+                    if (source.it->version() > newest->it->version()) {
+                        newest = &source;
+                    }
+                }
+            }
+
+            merged.add_item(*newest->it);
+            merged.commit();
+
+            for (auto& source : sources) {
+                if (!source.done && source.it->type() == type && source.it->id() == id) {
+                    advance(source);
+                }
+            }
+        }
+
+        if (!merged.committed()) {
+            return osmium::memory::Buffer();
+        }
+
+        return merged;
+    }
+
+    void MergedInput::advance(Source& source) {
+        if (source.it != source.end) {
+            ++source.it;
+        }
+
+        while (source.it == source.end) {
+            source.buffer = source.reader->read();
+            if (!source.buffer) {
+                source.done = true;
+                return;
+            }
+            source.it = source.buffer.begin<osmium::OSMObject>();
+            source.end = source.buffer.end<osmium::OSMObject>();
+        }
+
+        osmium::item_type type = source.it->type();
+        osmium::object_id_type id = source.it->id();
+        if (!source.unsorted && (type < source.lastType || (type == source.lastType && id < source.lastId))) {
+            source.unsorted = true;
+            cerr << "Warning: " << source.path << " is not sorted by type and id; objects it shares with other files may be duplicated." << endl;
+        }
+        source.lastType = type;
+        source.lastId = id;
+    }
+
+    void MergedInput::close() {
+        if (closed) {
+            return;
+        }
+        closed = true;
+
+        for (auto& source : sources) {
+            source.reader->close();
+        }
+    }
+}
@@ -0,0 +1,65 @@
+#ifndef __MERGEDINPUT_HXX__
+#define __MERGEDINPUT_HXX__
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <osmium/io/any_input.hpp>
+#include <osmium/osm/box.hpp>
+#include <osmium/osm/object.hpp>
+
+using namespace std;
+
+namespace osmwave {
+    // Reads several OSM files as if they were one. Every file has its own
+    // reader, so they are all decoded concurrently, and their objects are
+    // merged in (type, id) order; an object found in several files, like a
+    // building on the border of two extracts, is passed on once, in its
+    // highest version. Files are expected to be sorted by type and id, as
+    // extracts are; duplicates in an unsorted file may be missed.
+    //
+    // With a single file, buffers are passed on as read. Like a Reader,
+    // this can be used as the source of MultipolygonCollector::read_relations.
+    class MergedInput {
+        struct Source {
+            string path;
+            unique_ptr<osmium::io::Reader> reader;
+            osmium::memory::Buffer buffer;
+            osmium::memory::Buffer::t_iterator<osmium::OSMObject> it;
+            osmium::memory::Buffer::t_iterator<osmium::OSMObject> end;
+            bool done;
+            bool unsorted;
+            osmium::item_type lastType;
+            osmium::object_id_type lastId;
+        };
+
+        vector<Source> sources;
+        bool started;
+        bool closed;
+        size_t duplicates;
+
+    public:
+        MergedInput(const vector<string>& paths, osmium::osm_entity_bits::type entities = osmium::osm_entity_bits::all);
+        ~MergedInput();
+
+        MergedInput(const MergedInput&) = delete;
+        MergedInput& operator=(const MergedInput&) = delete;
+
+        // Union of the bounding boxes in the file headers; false if no
+        // file has one
+        bool bounds(osmium::Box& box);
+
+        // Next buffer of objects; an invalid buffer once all files are read
+        osmium::memory::Buffer read();
+        void close();
+
+        // Objects dropped because a copy was found in another file
+        size_t duplicateCount() const { return duplicates; }
+
+    private:
+        void advance(Source& source);
+    };
+}
+
+#endif
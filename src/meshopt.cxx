@@ -0,0 +1,215 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include "meshopt.hxx"
+#include "parallel.hxx"
+
+using namespace std;
+
+namespace osmwave {
+    // Constants from Forsyth's article; the cache the scores model is of
+    // the same size as the one misses are counted for
+    const float CACHE_DECAY_POWER = 1.5f;
+    const float LAST_TRIANGLE_SCORE = 0.75f;
+    const float VALENCE_BOOST_SCALE = 2.0f;
+    const float VALENCE_BOOST_POWER = 0.5f;
+
+    size_t vertex_cache_misses(const uint32_t* indices, size_t nIndices, size_t nVertices, size_t cacheSize) {
+        // A vertex is cached if fewer than cacheSize misses happened since
+        // it was last loaded, which is what a FIFO cache does
+        vector<size_t> loaded(nVertices, 0);
+        size_t time = cacheSize + 1;
+        size_t misses = 0;
+        for (size_t i = 0; i < nIndices; i++) {
+            uint32_t v = indices[i];
+            if (time - loaded[v] > cacheSize) {
+                loaded[v] = time++;
+                misses++;
+            }
+        }
+
+        return misses;
+    }
+
+    static inline float vertex_score(int cachePosition, uint32_t remaining) {
+        if (!remaining) {
+            return -1;
+        }
+
+        float score = 0;
+        if (cachePosition >= 0) {
+            // The last triangle's vertices get a fixed score, so that its
+            // neighbours are not favored just for the order of its corners
+            if (cachePosition < 3) {
+                score = LAST_TRIANGLE_SCORE;
+            } else {
+                score = pow(1 - (float)(cachePosition - 3) / (VERTEX_CACHE_SIZE - 3), CACHE_DECAY_POWER);
+            }
+        }
+
+        // Vertices with few triangles left are finished off first
+        return score + VALENCE_BOOST_SCALE * pow((float)remaining, -VALENCE_BOOST_POWER);
+    }
+
+    void optimize_vertex_cache(uint32_t* indices, size_t nIndices) {
+        size_t nTriangles = nIndices / 3;
+        if (nTriangles < 2) {
+            return;
+        }
+
+        // Work on compact vertex numbers, whatever the indices are
+        vector<uint32_t> vertices(indices, indices + nIndices);
+        sort(vertices.begin(), vertices.end());
+        vertices.erase(unique(vertices.begin(), vertices.end()), vertices.end());
+        size_t nVerts = vertices.size();
+
+        vector<uint32_t> local(nIndices);
+        for (size_t i = 0; i < nIndices; i++) {
+            local[i] = lower_bound(vertices.begin(), vertices.end(), indices[i]) - vertices.begin();
+        }
+
+        // Triangles not yet emitted of each vertex, in adjacency from
+        // offsets[v], remaining[v] of them
+        vector<uint32_t> remaining(nVerts, 0);
+        for (uint32_t v : local) {
+            remaining[v]++;
+        }
+        vector<uint32_t> offsets(nVerts + 1, 0);
+        partial_sum(remaining.begin(), remaining.end(), offsets.begin() + 1);
+        vector<uint32_t> adjacency(nIndices);
+        vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+        for (size_t i = 0; i < nIndices; i++) {
+            adjacency[fill[local[i]]++] = i / 3;
+        }
+
+        vector<int> cachePosition(nVerts, -1);
+        vector<float> vertexScore(nVerts);
+        for (size_t v = 0; v < nVerts; v++) {
+            vertexScore[v] = vertex_score(-1, remaining[v]);
+        }
+
+        vector<float> triangleScore(nTriangles);
+        size_t best = 0;
+        for (size_t t = 0; t < nTriangles; t++) {
+            triangleScore[t] = vertexScore[local[t * 3]] + vertexScore[local[t * 3 + 1]] + vertexScore[local[t * 3 + 2]];
+            if (triangleScore[t] > triangleScore[best]) {
+                best = t;
+            }
+        }
+
+        vector<bool> emitted(nTriangles, false);
+        vector<uint32_t> sorted;
+        sorted.reserve(nTriangles * 3);
+        vector<uint32_t> cache;
+        vector<uint32_t> nextCache;
+        size_t next = 0;
+
+        for (size_t n = 0; n < nTriangles; n++) {
+            if (best == numeric_limits<size_t>::max()) {
+                // Nothing in the cache has triangles left; continue with
+                // the next triangle in the original order
+                while (emitted[next]) {
+                    next++;
+                }
+                best = next;
+            }
+
+            emitted[best] = true;
+            nextCache.clear();
+            for (int k = 0; k < 3; k++) {
+                uint32_t v = local[best * 3 + k];
+                sorted.push_back(indices[best * 3 + k]);
+                nextCache.push_back(v);
+
+                uint32_t* begin = &adjacency[offsets[v]];
+                uint32_t* end = begin + remaining[v];
+                *find(begin, end, (uint32_t)best) = *(end - 1);
+                remaining[v]--;
+            }
+
+            for (uint32_t v : cache) {
+                if (v != nextCache[0] && v != nextCache[1] && v != nextCache[2]) {
+                    nextCache.push_back(v);
+                }
+            }
+
+            // Rescore vertices in the cache, and those just pushed out of
+            // it, and their triangles
+            for (size_t i = 0; i < nextCache.size(); i++) {
+                uint32_t v = nextCache[i];
+                cachePosition[v] = i < VERTEX_CACHE_SIZE ? (int)i : -1;
+                float score = vertex_score(cachePosition[v], remaining[v]);
+                float delta = score - vertexScore[v];
+                vertexScore[v] = score;
+                for (uint32_t j = offsets[v]; j < offsets[v] + remaining[v]; j++) {
+                    triangleScore[adjacency[j]] += delta;
+                }
+            }
+
+            if (nextCache.size() > VERTEX_CACHE_SIZE) {
+                nextCache.resize(VERTEX_CACHE_SIZE);
+            }
+            cache.swap(nextCache);
+
+            best = numeric_limits<size_t>::max();
+            float bestScore = -1;
+            for (uint32_t v : cache) {
+                for (uint32_t j = offsets[v]; j < offsets[v] + remaining[v]; j++) {
+                    if (triangleScore[adjacency[j]] > bestScore) {
+                        bestScore = triangleScore[adjacency[j]];
+                        best = adjacency[j];
+                    }
+                }
+            }
+        }
+
+        copy(sorted.begin(), sorted.end(), indices);
+    }
+
+    void optimize_mesh(vector<uint32_t>& indices, const vector<uint32_t>& chunks, size_t nVertices, vector<uint32_t>& order) {
+        size_t nTriangles = indices.size() / 3;
+
+        vector<uint32_t> triangles(nTriangles);
+        iota(triangles.begin(), triangles.end(), 0);
+        stable_sort(triangles.begin(), triangles.end(), [&chunks](uint32_t a, uint32_t b) {
+            return chunks[a] < chunks[b];
+        });
+
+        vector<uint32_t> grouped(nTriangles * 3);
+        vector<size_t> starts;
+        for (size_t i = 0; i < nTriangles; i++) {
+            uint32_t t = triangles[i];
+            if (!i || chunks[t] != chunks[triangles[i - 1]]) {
+                starts.push_back(i);
+            }
+            copy(&indices[t * 3], &indices[t * 3] + 3, &grouped[i * 3]);
+        }
+        starts.push_back(nTriangles);
+
+        parallel_for(starts.size() - 1, [&grouped, &starts](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                optimize_vertex_cache(&grouped[starts[i] * 3], (starts[i + 1] - starts[i]) * 3);
+            }
+        }, 1);
+
+        const uint32_t unused = numeric_limits<uint32_t>::max();
+        vector<uint32_t> remap(nVertices, unused);
+        order.clear();
+        order.reserve(nVertices);
+        for (uint32_t& v : grouped) {
+            if (remap[v] == unused) {
+                remap[v] = order.size();
+                order.push_back(v);
+            }
+            v = remap[v];
+        }
+        for (uint32_t v = 0; v < nVertices; v++) {
+            if (remap[v] == unused) {
+                order.push_back(v);
+            }
+        }
+
+        indices.swap(grouped);
+    }
+}
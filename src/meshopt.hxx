@@ -0,0 +1,35 @@
+#ifndef __MESHOPT_HXX__
+#define __MESHOPT_HXX__
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+using namespace std;
+
+namespace osmwave {
+    // Entries of the FIFO post-transform vertex cache that cache misses
+    // are counted for
+    const size_t VERTEX_CACHE_SIZE = 32;
+
+    // Number of vertices a FIFO cache of cacheSize entries has to transform
+    // to draw the triangle list indices of a mesh with nVertices vertices.
+    // Divided by the number of triangles this gives the average cache miss
+    // ratio (ACMR): 3 when nothing is reused, about 0.5 at best.
+    size_t vertex_cache_misses(const uint32_t* indices, size_t nIndices, size_t nVertices, size_t cacheSize = VERTEX_CACHE_SIZE);
+
+    // Reorders the triangles of a triangle list for vertex cache reuse,
+    // with Tom Forsyth's "Linear-Speed Vertex Cache Optimisation". Vertex
+    // indices can be anything; they are not changed.
+    void optimize_vertex_cache(uint32_t* indices, size_t nIndices);
+
+    // Optimizes a triangle list for drawing: triangles are grouped by
+    // their entry in chunks, in increasing chunk order, and each group is
+    // reordered with optimize_vertex_cache, on all cores. Vertices are
+    // then renumbered in the order they are first used, so that they are
+    // fetched close to in order; unused vertices go last. order receives
+    // the old index of each new vertex.
+    void optimize_mesh(vector<uint32_t>& indices, const vector<uint32_t>& chunks, size_t nVertices, vector<uint32_t>& order);
+}
+
+#endif
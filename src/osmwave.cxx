@@ -2,7 +2,11 @@
 #include <iostream>
 #include <memory>
 #include <algorithm>
-#include <boost/regex.hpp>
+#include <future>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
 
 #include <osmium/area/assembler.hpp>
 #include <osmium/area/multipolygon_collector.hpp>
@@ -17,37 +21,135 @@
 #include <osmium/visitor.hpp>
 #include <proj_api.h>
 //#include "earcut.hxx"
+#include "osmwave.hxx"
 #include "ObjWriter.hxx"
 #include "elevation.hxx"
+#include "clip.hxx"
+#include "terrainmesh.hxx"
+#include "localframe.hxx"
+#include "projection.hxx"
+#include "hilbert.hxx"
+#include "mergedinput.hxx"
+#include "lod.hxx"
+#include "outputstream.hxx"
+#include "highways.hxx"
+#include "buildings.hxx"
+#include "instancing.hxx"
+#include "arena.hxx"
+#include "alloccount.hxx"
 
 using namespace std;
-using namespace boost;
 using namespace osmwave;
 
 typedef osmium::index::map::Map<osmium::unsigned_object_id_type, osmium::Location> index_type;
 typedef osmium::handler::NodeLocationsForWays<index_type> location_handler_type;
 
-projPJ wgs84 = pj_init_plus("+proj=longlat +ellps=WGS84 +datum=WGS84 +no_defs");
 const double METERS_PER_LEVEL = 3.0;
 
+// Parses height tag values like "12", "12.5 m" or "12m": a number,
+// optionally followed by a unit, which is ignored.
+static bool parse_height(const char* value, double& height) {
+    const char* s = value;
+    while (isspace((unsigned char)*s)) s++;
+    const char* number = s;
+    while (isdigit((unsigned char)*s) || *s == '.') s++;
+    size_t length = s - number;
+    while (isspace((unsigned char)*s)) s++;
+    while (*s && !isspace((unsigned char)*s)) s++;
+    while (isspace((unsigned char)*s)) s++;
+
+    char buffer[32];
+    if (*s || length == 0 || length >= sizeof(buffer)) {
+        return false;
+    }
+
+    // Copied, so that strtod does not read into the unit
+    memcpy(buffer, number, length);
+    buffer[length] = '\0';
+    char* end;
+    double parsed = strtod(buffer, &end);
+    if (end == buffer) {
+        return false;
+    }
+
+    height = parsed;
+    return true;
+}
+
 class ObjHandler : public osmium::handler::Handler {
-    projPJ proj;
-    ObjWriter writer;
-    vector<double> wayCoords;
+    const Projection& projection;
+    const LocalFrame& frame;
+    ObjWriter& writer;
+    RingSink& sink;
+    // Scratch memory for the areas of one buffer
+    Arena arena;
+    double* wayCoords;
     Elevation& elevation;
+    const Clip* clip;
+    BackgroundTerrain* terrain;
     double defaultBuildingHeight;
 
+    // Areas in the current buffer, and whether a buffer with areas has
+    // been handled, warming up the arena and output buffers
+    size_t bufferAreas;
+    bool warm;
+    size_t areas;
+    size_t allocations;
+    size_t steadyAreas;
+    size_t steadyAllocations;
+
 public:
-    ObjHandler(projPJ p, ObjWriter writer, Elevation& elevation, double defaultBuildingHeight = 8) : 
-        proj(p), writer(writer), elevation(elevation), defaultBuildingHeight(defaultBuildingHeight) {}
+    ObjHandler(const Projection& projection, const LocalFrame& frame, ObjWriter& writer, RingSink& sink, Elevation& elevation, const Clip* clip, BackgroundTerrain* terrain, double defaultBuildingHeight = 8) : 
+        projection(projection), frame(frame), writer(writer), sink(sink), wayCoords(nullptr), elevation(elevation), clip(clip), terrain(terrain), defaultBuildingHeight(defaultBuildingHeight),
+        bufferAreas(0), warm(false), areas(0), allocations(0), steadyAreas(0), steadyAllocations(0) {}
 
     void area(osmium::Area& area) {
+        size_t before = allocation_count();
+        buildArea(area);
+        size_t made = allocation_count() - before;
+
+        areas++;
+        bufferAreas++;
+        allocations += made;
+        // Buffers without areas, like those with only nodes, warm up nothing
+        if (warm) {
+            steadyAreas++;
+            steadyAllocations += made;
+        }
+    }
+
+    // Called after all areas of a buffer are handled
+    void endBuffer() {
+        arena.reset();
+        if (bufferAreas) {
+            warm = true;
+        }
+        bufferAreas = 0;
+    }
+
+    // Only allocations through operator new are counted; malloc calls
+    // made by C libraries, like zlib, are not
+    void printStats(ostream& out) {
+        out << "Heap allocations are counted through operator new only" << endl;
+        out << "Areas: " << areas << ", heap allocations: " << allocations << endl;
+        out << "Areas after the first buffer with areas: " << steadyAreas << ", heap allocations: " << steadyAllocations;
+        if (steadyAreas) {
+            out << " (" << (double)steadyAllocations / steadyAreas << " per area)";
+        }
+        out << endl;
+    }
+
+private:
+    void buildArea(osmium::Area& area) {
         const osmium::TagList& tags = area.tags();
         const char* building = tags.get_value_by_key("building");
         const char* buildingPart = tags.get_value_by_key("building:part");
-        const char* highway = tags.get_value_by_key("highway");
 
-        if (!building && !buildingPart /*&& !highway*/) {
+        if (!building && !buildingPart) {
+            return;
+        }
+
+        if (clip && !inClip(area)) {
             return;
         }
 
@@ -58,79 +160,84 @@ public:
             const osmium::NodeRefList& nodes = *oit;
             int nNodes = nodes.size();
 
-            if (wayCoords.capacity() < nNodes) {
-                wayCoords.reserve(nNodes * 2);
+            wayCoords = arena.alloc<double>(nNodes * 2);
+            int i = 0;
+            for (auto& nr : nodes) {
+                wayCoords[i++] = nr.lon() * DEG_TO_RAD;
+                wayCoords[i++] = nr.lat() * DEG_TO_RAD;
             }
 
-            double minElevation = numeric_limits<double>::max();
-            for (auto& nr : nodes) {
-                double lon = nr.lon();
-                double lat = nr.lat();
-                wayCoords.push_back(lon * DEG_TO_RAD);
-                wayCoords.push_back(lat * DEG_TO_RAD);
-                minElevation = min(minElevation, elevation.elevation(lat, lon));
+            projection.forward(wayCoords, nNodes);
+            for (i = 0; i < nNodes * 2; i += 2) {
+                wayCoords[i] -= frame.originX;
+                wayCoords[i + 1] -= frame.originY;
             }
+            double minElevation = ringBaseElevation(nodes);
 
-            pj_transform(wgs84, proj, nodes.size(), 2, wayCoords.data(), wayCoords.data() + 1, nullptr);
+            sink.ring(wayCoords, nNodes, minElevation + baseHeight, height - baseHeight);
+        }
+    }
 
-            ringWalls(wayCoords, minElevation + baseHeight, height - baseHeight);
-            flatRoof(nNodes);
+    // Lowest ground elevation under the ring; taken from the terrain mesh
+    // when one is built, so that the building sits on it.
+    double ringBaseElevation(const osmium::NodeRefList& nodes) {
+        double minElevation = numeric_limits<double>::max();
+        int i = 0;
 
-            wayCoords.clear();
+        for (auto& nr : nodes) {
+            double z;
+            if (!terrain || !terrain->height(writer, wayCoords[i], wayCoords[i + 1], z)) {
+                z = elevation.elevation(nr.lat(), nr.lon());
+            }
+            minElevation = min(minElevation, z);
+            i += 2;
         }
+
+        return minElevation;
     }
 
-private:
-    void ringWalls(vector<double> wayCoords, double elevation, double height) {
-        int nVerts = wayCoords.size() / 2;
-        int vertexCount = 0;
-        writer.checkpoint();
-        for (vector<double>::iterator i = wayCoords.begin(); i != wayCoords.end(); i += 2) {
-            writer.vertex(*(i + 1), elevation, *i);
-            writer.vertex(*(i + 1), elevation + height, *i);
-
-            if (vertexCount) {
-                writer.beginFace();
-                writer << (vertexCount - 2) << (vertexCount) << (vertexCount + 1) << (vertexCount - 1);
-                writer.endFace();
-            }
+    bool inClip(const osmium::Area& area) {
+        osmium::Box box = area.envelope();
+        if (!box.valid() || !clip->intersects(box.bottom_left().lon(), box.bottom_left().lat(), box.top_right().lon(), box.top_right().lat())) {
+            return false;
+        }
 
-            vertexCount += 2;
+        if (!clip->hasPolygon()) {
+            return true;
         }
-    }
 
-    void flatRoof(int nVerts) {
-        writer.beginFace();
-        for (int i = 0; i < nVerts; i++) {
-            writer << (i * 2 + 1);
+        for (auto oit = area.cbegin<osmium::OuterRing>(); oit != area.cend<osmium::OuterRing>(); ++oit) {
+            double* ring = arena.alloc<double>(oit->size() * 2);
+            size_t n = 0;
+            for (auto& nr : *oit) {
+                ring[n * 2] = nr.lon();
+                ring[n * 2 + 1] = nr.lat();
+                n++;
+            }
+
+            if (clip->intersectsPath(ring, n, true)) {
+                return true;
+            }
         }
-        writer.endFace();
+
+        return false;
     }
 
     double getBuildingHeight(const osmium::TagList& tags, double defaultHeight, const char* heightTagName, const char* levelTagName) {
-        regex heightexpr("^\\s*([0-9\\.]+)\\s*(\\S*)\\s*$");
         const char* heightTag = tags[heightTagName];
         double height = defaultHeight;
 
         if (heightTag) {
-            string heightStr(heightTag);
-            auto match_begin = 
-                sregex_iterator(heightStr.begin(), heightStr.end(), heightexpr);
-            auto match_end = sregex_iterator();
-
-            if (match_begin != match_end) {
-                smatch match = *match_begin;
-                height = stod(match[1]);
-            }
+            parse_height(heightTag, height);
         } else {
             const char* levelsTag = tags[levelTagName];
             if (levelsTag) {
-                string levelsStr(levelsTag);
-                try {
-                    double levels = stod(levelsStr);
+                char* end;
+                double levels = strtod(levelsTag, &end);
+                if (end != levelsTag) {
                     height = levels * METERS_PER_LEVEL;
-                } catch (const invalid_argument& ia) {
-                    cerr << "Unparseable value for \"building:levels\" tag: \"" << levelsStr << "\"" << endl; 
+                } else {
+                    cerr << "Unparseable value for \"" << levelTagName << "\" tag: \"" << levelsTag << "\"" << endl; 
                 }
             }
         }
@@ -139,25 +246,75 @@ private:
     }
 };
 
-string* get_proj(osmium::io::Header& header) {
-    auto& box = header.boxes()[0];
-    float clat = (box.bottom_left().lat() + box.top_right().lat()) / 2;
-    float clon = (box.bottom_left().lon() + box.top_right().lon()) / 2;
+string* get_proj(const osmium::Location& sw, const osmium::Location& ne) {
+    float clat = (sw.lat() + ne.lat()) / 2;
+    float clon = (sw.lon() + ne.lon()) / 2;
 
     ostringstream stream;
     stream << "+proj=tmerc +lat_0=" << clat << " +lon_0=" << clon << " +k=1.000000 +x_0=0 +y_0=0 +ellps=WGS84 +datum=WGS84 +units=m +no_defs";
     return new string(stream.str());
 }
 
+// Closed building ways entirely outside the clip region are dropped here,
+// before the multipolygon collector spends time assembling them. Other ways
+// are kept, since they may be parts of highways.
+static bool way_in_clip(const osmium::Way& way, const Clip& clip) {
+    const osmium::TagList& tags = way.tags();
+    if (!way.is_closed() || (!tags.has_key("building") && !tags.has_key("building:part"))) {
+        return true;
+    }
+
+    osmium::Box box = way.envelope();
+    return !box.valid() ||
+        clip.intersects(box.bottom_left().lon(), box.bottom_left().lat(), box.top_right().lon(), box.top_right().lat());
+}
+
+// Passes everything on to the next handler, except the ways way_in_clip
+// drops; without a clip, everything is passed on. Members of relations
+// are always passed on, since a relation reaching into the clip region
+// can not be assembled without all of its members.
+template <typename THandler>
+class ClipFilter : public osmium::handler::Handler {
+    THandler& next;
+    const Clip* clip;
+    // Sorted ids of the ways that are relation members
+    vector<osmium::object_id_type> members;
+
+public:
+    ClipFilter(THandler& next, const Clip* clip, vector<osmium::object_id_type>&& members) :
+        next(next), clip(clip), members(move(members)) {}
+
+    void node(const osmium::Node& node) {
+        next.node(node);
+    }
+
+    void way(osmium::Way& way) {
+        if (!clip || binary_search(members.begin(), members.end(), way.id()) || way_in_clip(way, *clip)) {
+            next.way(way);
+        }
+    }
+
+    void relation(const osmium::Relation& relation) {
+        next.relation(relation);
+    }
+
+    void flush() {
+        next.flush();
+    }
+};
+
 namespace osmwave {
-    void write_obj_header(ObjWriter& objWriter, const string& osmFile, const osmium::Location& sw, const osmium::Location& ne, projPJ proj) {
+    void write_obj_header(ObjWriter& objWriter, const vector<string>& osmFiles, const osmium::Location& sw, const osmium::Location& ne, const Projection& projection, const LocalFrame& frame) {
         ostringstream c;
         c.precision(7);
 
         objWriter.comment("Created with OSMWAVE");
         objWriter.comment("");
 
-        c << "Input file: " << osmFile;
+        c << (osmFiles.size() > 1 ? "Input files: " : "Input file: ");
+        for (size_t i = 0; i < osmFiles.size(); i++) {
+            c << (i ? ", " : "") << osmFiles[i];
+        }
         objWriter.comment(c.str());
         cerr << c.str() << endl;
 
@@ -167,7 +324,7 @@ namespace osmwave {
         cerr << c.str() << endl;
 
         c.str("");
-        c << "Projection: " << pj_get_def(proj, 0);
+        c << "Projection: " << projection.definition();
         objWriter.comment(c.str());
         cerr << c.str() << endl;
 
@@ -176,59 +333,190 @@ namespace osmwave {
         c << "Projected bounds: (";
         coord[0] = sw.lon() * DEG_TO_RAD;
         coord[1] = sw.lat() * DEG_TO_RAD;
-        pj_transform(wgs84, proj, 1, 2, coord, coord + 1, nullptr);
+        projection.forward(coord, 1);
         c << coord[0] << ", " << coord[1];
         c << ") - (";
         coord[0] = ne.lon() * DEG_TO_RAD;
         coord[1] = ne.lat() * DEG_TO_RAD;
-        pj_transform(wgs84, proj, 1, 2, coord, coord + 1, nullptr);
+        projection.forward(coord, 1);
         c << coord[0] << ", " << coord[1];
         c << ")";
         objWriter.comment(c.str());
         cerr << c.str() << endl;
+
+        if (frame.single) {
+            objWriter.comment(frame.comment());
+            cerr << frame.comment() << endl;
+        }
     }
 
-    void osm_to_obj(const std::string& osmFile, const std::string& elevationPath, const std::string* projDef) {
-        ObjWriter objWriter(cout);
+    bool osm_to_obj(const std::vector<std::string>& osmFiles, const std::string& elevationPath, const Options& options) {
+        // Byte offsets for the chunk index are counted before compression,
+        // or taken from the compressor at block boundaries
+        unique_ptr<CountingStreambuf> counter;
+        unique_ptr<ostream> counted;
+        if (options.chunkIndex) {
+            counter.reset(new CountingStreambuf(options.output->rdbuf()));
+            counted.reset(new ostream(counter.get()));
+        }
+
+        ObjWriter objWriter(counted ? *counted : *options.output);
+        const Clip* clip = options.clip;
+        const string* projDef = options.projDef;
 
-        osmium::io::File infile(osmFile);
         osmium::area::Assembler::config_type assembler_config;
         osmium::area::MultipolygonCollector<osmium::area::Assembler> collector(assembler_config);
 
-        osmium::io::Reader reader1(infile, osmium::osm_entity_bits::relation);
-        collector.read_relations(reader1);
-        reader1.close();
+        // The main pass input is opened first, so that its headers can be
+        // used to set up projection, elevation and terrain while the
+        // relation pass runs.
+        MergedInput input2(osmFiles);
 
-        osmium::io::Reader reader2(osmFile);
-        osmium::io::Header header = reader2.header();
-        projPJ proj;
+        osmium::Location sw;
+        osmium::Location ne;
+        if (clip) {
+            sw = osmium::Location(clip->getWest(), clip->getSouth());
+            ne = osmium::Location(clip->getEast(), clip->getNorth());
+        } else {
+            osmium::Box box;
+            if (!input2.bounds(box)) {
+                cerr << "No bounding box in the input file header; pass one with --bbox." << endl;
+                return false;
+            }
+            sw = box.bottom_left();
+            ne = box.top_right();
+        }
 
-        auto& box = header.boxes()[0];
-        auto& sw = box.bottom_left();
-        auto& ne = box.top_right();
-        float clat = (box.bottom_left().lat() + box.top_right().lat()) / 2;
-        float clon = (box.bottom_left().lon() + box.top_right().lon()) / 2;
+        unique_ptr<const string> defaultProjDef;
         if (!projDef) {
-            projDef = get_proj(header);
-            proj = pj_init_plus(projDef->c_str());
-            delete projDef;
-        } else {
-            proj = pj_init_plus(projDef->c_str());
+            defaultProjDef.reset(get_proj(sw, ne));
+            projDef = defaultProjDef.get();
+        }
+
+        Projection projection(*projDef);
+        if (!projection.isValid()) {
+            cerr << "Invalid projection \"" << *projDef << "\"" << endl;
+            return false;
+        }
+
+        LocalFrame frame = LocalFrame::forBounds(projection, sw.lon(), sw.lat(), ne.lon(), ne.lat(), options.singlePrecision);
+        write_obj_header(objWriter, osmFiles, sw, ne, projection, frame);
+
+        // Buildings straddling the clip border have nodes slightly outside
+        // it, so load elevation with some margin. Tiles are read in the
+        // background while the relation pass runs.
+        double margin = clip ? 0.01 : 0;
+        Elevation elevation((int)floor(sw.lat() - margin), (int)floor(sw.lon() - margin), (int)floor(ne.lat() + margin), (int)floor(ne.lon() + margin), elevationPath);
+
+        unique_ptr<BackgroundTerrain> terrain;
+        if (options.terrain) {
+            terrain.reset(new BackgroundTerrain(elevation, *projDef, frame, sw.lon(), sw.lat(), ne.lon(), ne.lat(), options.optimizeMesh));
+        }
+
+        // Highway junctions are found in a pass over the ways, alongside
+        // the relation pass
+        future<vector<osmium::object_id_type>> junctions;
+        if (options.highways) {
+            junctions = async(launch::async, [&osmFiles]() {
+                JunctionFinder finder;
+                MergedInput ways(osmFiles, osmium::osm_entity_bits::way);
+                while (osmium::memory::Buffer buffer = ways.read()) {
+                    osmium::apply(buffer, finder);
+                }
+                ways.close();
+                return finder.junctions();
+            });
         }
 
-        write_obj_header(objWriter, osmFile, sw, ne, proj);
+        MergedInput input1(osmFiles, osmium::osm_entity_bits::relation);
+        collector.read_relations(input1);
+        input1.close();
 
         const auto& map_factory = osmium::index::MapFactory<osmium::unsigned_object_id_type, osmium::Location>::instance();
         unique_ptr<index_type> index = map_factory.create_map("sparse_mem_array");
         location_handler_type location_handler(*index);
         location_handler.ignore_errors();
 
-        Elevation elevation((int)floor(sw.lat()), (int)floor(sw.lon()), (int)floor(ne.lat()), (int)floor(ne.lon()), elevationPath);
-        ObjHandler handler(proj, objWriter, elevation);
-        osmium::apply(reader2, location_handler, collector.handler([&handler](osmium::memory::Buffer&& buffer) {
+        RingWriter ringWriter(objWriter, options.optimizeMesh);
+        RingSink* sink = &ringWriter;
+
+        unique_ptr<HilbertSorter> sorter;
+        if (options.hilbertOrder || options.chunkIndex) {
+            double box[] = {
+                sw.lon() * DEG_TO_RAD, sw.lat() * DEG_TO_RAD,
+                ne.lon() * DEG_TO_RAD, sw.lat() * DEG_TO_RAD,
+                sw.lon() * DEG_TO_RAD, ne.lat() * DEG_TO_RAD,
+                ne.lon() * DEG_TO_RAD, ne.lat() * DEG_TO_RAD
+            };
+            projection.forward(box, 4);
+            double minX = min(box[0], box[4]) - frame.originX, maxX = max(box[2], box[6]) - frame.originX;
+            double minY = min(box[1], box[3]) - frame.originY, maxY = max(box[5], box[7]) - frame.originY;
+
+            sorter.reset(new HilbertSorter(*sink, minX, minY, maxX, maxY));
+            if (options.chunkIndex) {
+                sorter->setIndex(*options.chunkIndex, objWriter, *counter, dynamic_cast<CompressingStreambuf*>(options.output->rdbuf()));
+            }
+            sink = sorter.get();
+        }
+
+        // Buildings that are not instanced still go through the sorter
+        unique_ptr<ObjWriter> prototypeWriter;
+        unique_ptr<BuildingInstancer> instancer;
+        if (options.instances) {
+            prototypeWriter.reset(new ObjWriter(*options.prototypes));
+            prototypeWriter->comment("Prototypes of repeated building shapes, around the origin");
+            instancer.reset(new BuildingInstancer(*prototypeWriter, *options.instances, *sink));
+            sink = instancer.get();
+        }
+
+        // Levels of detail are built from every building, instanced or not
+        unique_ptr<LodBuilder> lod;
+        if (!options.lodThresholds.empty()) {
+            lod.reset(new LodBuilder(*sink, options.lodThresholds, options.lodPrefix, frame, options.optimizeMesh));
+            sink = lod.get();
+        }
+
+        ObjHandler handler(projection, frame, objWriter, *sink, elevation, clip, terrain.get());
+        HighwayHandler highwayHandler(projection, frame, objWriter, elevation, clip, terrain.get(),
+            options.highways ? junctions.get() : vector<osmium::object_id_type>());
+        auto areaHandler = collector.handler([&handler](osmium::memory::Buffer&& buffer) {
             osmium::apply(buffer, handler);
-        }));
-        reader2.close();
+            handler.endBuffer();
+        });
+
+        vector<osmium::object_id_type> members;
+        if (clip) {
+            for (auto& member : collector.member_meta(osmium::item_type::way)) {
+                members.push_back(member.member_id());
+            }
+            sort(members.begin(), members.end());
+            members.erase(unique(members.begin(), members.end()), members.end());
+        }
+        ClipFilter<decltype(areaHandler)> clipFilter(areaHandler, clip, move(members));
+        while (osmium::memory::Buffer buffer = input2.read()) {
+            if (options.highways) {
+                osmium::apply(buffer, location_handler, highwayHandler);
+            } else {
+                osmium::apply(buffer, location_handler);
+            }
+
+            osmium::apply(buffer, clipFilter);
+        }
+        input2.close();
+        if (input2.duplicateCount()) {
+            cerr << "Skipped " << input2.duplicateCount() << " objects found in more than one input file" << endl;
+        }
+
+        if (terrain) {
+            terrain->get(objWriter);
+        }
+
+        bool complete = sink->finish();
+
+        if (options.stats) {
+            handler.printStats(cerr);
+        }
+
+        return complete;
     }
 }
-
@@ -1,10 +1,49 @@
 #ifndef __OSMWAVE_HXX__
 #define __OSMWAVE_HXX__
 
+#include <iostream>
 #include <string>
+#include <vector>
+#include "clip.hxx"
 
 namespace osmwave {
-    void osm_to_obj(const std::string& osmFile, const std::string& elevationPath, const std::string* projDef);
+    struct Options {
+        std::ostream* output;
+        const std::string* projDef;
+        const Clip* clip;
+        // Also build the terrain mesh, and place buildings on it
+        bool terrain;
+        // Also build highway ribbons
+        bool highways;
+        // Sidecar for instances of repeated building shapes; when set,
+        // repeated shapes are written once, to prototypes, and left out of
+        // the model
+        std::ostream* instances;
+        std::ostream* prototypes;
+        // Print statistics, like heap allocations in the area handler
+        bool stats;
+        // Write geometry relative to a local origin, and keep the terrain
+        // mesh in single precision, if the extent allows it
+        bool singlePrecision;
+        // Write buildings ordered along a Hilbert curve
+        bool hilbertOrder;
+        // Index of the byte and vertex ranges of each chunk of buildings;
+        // implies hilbertOrder
+        std::ostream* chunkIndex;
+        // Error thresholds in meters of the building levels of detail to
+        // write, to lodPrefix<n>.obj
+        std::vector<double> lodThresholds;
+        std::string lodPrefix;
+        // Reorder triangles and vertices of terrain and buildings for the
+        // GPU vertex cache
+        bool optimizeMesh;
+
+        Options() : output(&std::cout), projDef(nullptr), clip(nullptr), terrain(false), highways(false), instances(nullptr), prototypes(nullptr), stats(false), singlePrecision(false),
+            hilbertOrder(false), chunkIndex(nullptr), optimizeMesh(false) {}
+    };
+
+    // Returns false, after printing why, if the model could not be built
+    bool osm_to_obj(const std::vector<std::string>& osmFiles, const std::string& elevationPath, const Options& options);
 }
 
 #endif
@@ -0,0 +1,263 @@
+#include <iostream>
+#include <zlib.h>
+#ifdef OSMWAVE_WITH_ZSTD
+#include <zstd.h>
+#endif
+#include "outputstream.hxx"
+
+using namespace std;
+
+namespace osmwave {
+    static bool compress_gzip(const string& data, string& result) {
+        z_stream zs;
+        zs.zalloc = Z_NULL;
+        zs.zfree = Z_NULL;
+        zs.opaque = Z_NULL;
+        // Window bits above 15 asks zlib for a gzip header and trailer
+        if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            cerr << "gzip compression failed: " << (zs.msg ? zs.msg : "out of memory") << '\n';
+            return false;
+        }
+
+        result.resize(deflateBound(&zs, data.size()));
+        zs.next_in = (Bytef*)data.data();
+        zs.avail_in = data.size();
+        zs.next_out = (Bytef*)&result[0];
+        zs.avail_out = result.size();
+        int status = deflate(&zs, Z_FINISH);
+        if (status != Z_STREAM_END) {
+            cerr << "gzip compression failed: " << (zs.msg ? zs.msg : "incomplete block") << '\n';
+        }
+        result.resize(zs.total_out);
+        deflateEnd(&zs);
+
+        return status == Z_STREAM_END;
+    }
+
+#ifdef OSMWAVE_WITH_ZSTD
+    static bool compress_zstd(const string& data, string& result) {
+        result.resize(ZSTD_compressBound(data.size()));
+        size_t size = ZSTD_compress(&result[0], result.size(), data.data(), data.size(), 3);
+        if (ZSTD_isError(size)) {
+            cerr << "zstd compression failed: " << ZSTD_getErrorName(size) << '\n';
+            return false;
+        }
+        result.resize(size);
+
+        return true;
+    }
+#endif
+
+    CompressingStreambuf::CompressingStreambuf(ostream& sink, Compression compression, size_t blockSize) :
+        sink(sink), compression(compression), blockSize(blockSize), written(0), block(make_shared<string>(blockSize, '\0')), failed(false), finished(false) {
+        setp(&(*block)[0], &(*block)[0] + blockSize);
+    }
+
+    CompressingStreambuf::~CompressingStreambuf() {
+        finish();
+    }
+
+    bool CompressingStreambuf::finish() {
+        if (!finished) {
+            finished = true;
+            submit();
+            drain(0);
+            sink.flush();
+            failed = failed || !sink;
+        }
+
+        return !failed;
+    }
+
+    CompressingStreambuf::int_type CompressingStreambuf::overflow(int_type c) {
+        submit();
+        if (failed) {
+            return traits_type::eof();
+        }
+
+        if (c != traits_type::eof()) {
+            *pptr() = traits_type::to_char_type(c);
+            pbump(1);
+        }
+
+        return traits_type::not_eof(c);
+    }
+
+    int CompressingStreambuf::sync() {
+        submit();
+        drain(0);
+        sink.flush();
+
+        return failed || !sink ? -1 : 0;
+    }
+
+    void CompressingStreambuf::submit() {
+        size_t used = pptr() - pbase();
+        if (!used) {
+            return;
+        }
+
+        Job job;
+        job.raw = block;
+        job.raw->resize(used);
+        job.compressed = make_shared<string>();
+
+        if (spare.empty()) {
+            block = make_shared<string>(blockSize, '\0');
+        } else {
+            block = spare.back();
+            spare.pop_back();
+            block->resize(blockSize);
+        }
+        setp(&(*block)[0], &(*block)[0] + blockSize);
+
+        shared_ptr<string> data = job.raw;
+        shared_ptr<string> compressed = job.compressed;
+        if (compression == Compression::ZSTD) {
+#ifdef OSMWAVE_WITH_ZSTD
+            job.ok = pool.submit([data, compressed]() { return compress_zstd(*data, *compressed); });
+#endif
+        } else {
+            job.ok = pool.submit([data, compressed]() { return compress_gzip(*data, *compressed); });
+        }
+        pending.push_back(move(job));
+
+        // Bound the memory held by blocks waiting to be written
+        drain(pool.size() * 2);
+    }
+
+    void CompressingStreambuf::drain(size_t maxPending) {
+        while (pending.size() > maxPending) {
+            Job& job = pending.front();
+            if (!job.ok.get()) {
+                failed = true;
+            } else if (!failed) {
+                sink.write(job.compressed->data(), job.compressed->size());
+                if (!sink) {
+                    cerr << "Unable to write compressed output" << '\n';
+                    failed = true;
+                }
+                written += job.compressed->size();
+            }
+            spare.push_back(job.raw);
+            pending.pop_front();
+        }
+    }
+
+    Compression compression_for_path(const string& path) {
+        auto endsWith = [&path](const string& suffix) {
+            return path.size() >= suffix.size() && path.compare(path.size() - suffix.size(), suffix.size(), suffix) == 0;
+        };
+
+        if (endsWith(".gz")) {
+            return Compression::GZIP;
+        } else if (endsWith(".zst")) {
+            return Compression::ZSTD;
+        }
+
+        return Compression::NONE;
+    }
+
+    CountingStreambuf::CountingStreambuf(streambuf* sink, size_t bufferSize) : sink(sink), buffer(bufferSize), flushed(0) {
+        setp(buffer.data(), buffer.data() + buffer.size());
+    }
+
+    CountingStreambuf::~CountingStreambuf() {
+        sync();
+    }
+
+    CountingStreambuf::int_type CountingStreambuf::overflow(int_type c) {
+        if (!flushBuffer()) {
+            return traits_type::eof();
+        }
+
+        if (c != traits_type::eof()) {
+            *pptr() = traits_type::to_char_type(c);
+            pbump(1);
+        }
+
+        return traits_type::not_eof(c);
+    }
+
+    int CountingStreambuf::sync() {
+        if (!flushBuffer()) {
+            return -1;
+        }
+
+        return sink->pubsync();
+    }
+
+    bool CountingStreambuf::flushBuffer() {
+        streamsize n = pptr() - pbase();
+        streamsize written = sink->sputn(pbase(), n);
+        flushed += n;
+        setp(buffer.data(), buffer.data() + buffer.size());
+        return written == n;
+    }
+
+    OutputFile::OutputFile(const string& path) : path(path), open(true) {
+        Compression compression = compression_for_path(path);
+        ostream* sink = &cout;
+
+#ifndef OSMWAVE_WITH_ZSTD
+        if (compression == Compression::ZSTD) {
+            cerr << "Unable to write " << path << ": built without zstd support\n";
+            open = false;
+            return;
+        }
+#endif
+
+        if (path != "-") {
+            file.open(path.c_str(), ios::out | ios::binary | ios::trunc);
+            if (!file.is_open()) {
+                cerr << "Unable to open output file " << path << '\n';
+                open = false;
+                return;
+            }
+            sink = &file;
+        }
+
+        if (compression != Compression::NONE) {
+            compressor.reset(new CompressingStreambuf(*sink, compression));
+            compressed.reset(new ostream(compressor.get()));
+        }
+    }
+
+    bool OutputFile::isOpen() const {
+        return open;
+    }
+
+    bool OutputFile::close() {
+        if (!open) {
+            return true;
+        }
+        open = false;
+
+        bool ok = true;
+        if (compressor) {
+            compressed->flush();
+            ok = compressor->finish();
+        }
+        if (file.is_open()) {
+            file.close();
+            ok = ok && !file.fail();
+        } else {
+            cout.flush();
+            ok = ok && cout.good();
+        }
+
+        if (!ok) {
+            cerr << "Unable to write output file " << path << '\n';
+        }
+
+        return ok;
+    }
+
+    ostream& OutputFile::stream() {
+        if (compressed) {
+            return *compressed;
+        }
+
+        return file.is_open() ? file : cout;
+    }
+}
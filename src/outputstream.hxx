@@ -0,0 +1,116 @@
+#ifndef __OUTPUTSTREAM_HXX__
+#define __OUTPUTSTREAM_HXX__
+
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <future>
+#include <memory>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <vector>
+#include "parallel.hxx"
+
+using namespace std;
+
+namespace osmwave {
+    enum class Compression { NONE, GZIP, ZSTD };
+
+    // Stream buffer that cuts its output into fixed size blocks, compresses
+    // them on a thread pool and writes them to the sink in order. Every
+    // block is a complete gzip member or zstd frame, and a concatenation of
+    // those is still a valid gzip or zstd stream.
+    //
+    // The put area is the block being filled, so writes only reach a
+    // virtual call once a block is full. Syncing the stream compresses and
+    // writes a partial block, so it is best left to the end.
+    //
+    // After a compression or write error, nothing more is written and the
+    // stream goes bad; finish() reports whether all data was written.
+    class CompressingStreambuf : public streambuf {
+        ostream& sink;
+        Compression compression;
+        size_t blockSize;
+        uint64_t written;
+        shared_ptr<string> block;
+        ThreadPool pool;
+        bool failed;
+        bool finished;
+
+        struct Job {
+            shared_ptr<string> raw;
+            shared_ptr<string> compressed;
+            future<bool> ok;
+        };
+        deque<Job> pending;
+        // Raw blocks already compressed, kept for reuse
+        vector<shared_ptr<string>> spare;
+
+    public:
+        CompressingStreambuf(ostream& sink, Compression compression, size_t blockSize = 1 << 20);
+        ~CompressingStreambuf();
+
+        // Writes out everything buffered; false if anything failed
+        bool finish();
+
+        // Compressed bytes written to the sink. Right after a sync, this is
+        // where the next block, which can be decompressed on its own, starts.
+        uint64_t position() const { return written; }
+
+    protected:
+        int_type overflow(int_type c);
+        int sync();
+
+    private:
+        void submit();
+        void drain(size_t maxPending);
+    };
+
+    // Stream buffer passing its output on to another one, keeping count of
+    // the bytes written, so that positions in the uncompressed output are
+    // known even when it is compressed.
+    class CountingStreambuf : public streambuf {
+        streambuf* sink;
+        vector<char> buffer;
+        uint64_t flushed;
+
+    public:
+        CountingStreambuf(streambuf* sink, size_t bufferSize = 1 << 16);
+        ~CountingStreambuf();
+
+        // Bytes written so far, including those still buffered
+        uint64_t position() const { return flushed + (pptr() - pbase()); }
+
+    protected:
+        int_type overflow(int_type c);
+        int sync();
+
+    private:
+        bool flushBuffer();
+    };
+
+    // Output file, or standard output for "-"; the suffix .gz selects gzip
+    // and .zst zstd compression.
+    class OutputFile {
+        string path;
+        ofstream file;
+        bool open;
+        unique_ptr<CompressingStreambuf> compressor;
+        unique_ptr<ostream> compressed;
+
+    public:
+        OutputFile(const string& path);
+
+        bool isOpen() const;
+        ostream& stream();
+
+        // Writes out everything and closes the file; false, with an error
+        // printed, if any of the output could not be written
+        bool close();
+    };
+
+    Compression compression_for_path(const string& path);
+}
+
+#endif
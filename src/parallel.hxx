@@ -0,0 +1,103 @@
+#ifndef __PARALLEL_HXX__
+#define __PARALLEL_HXX__
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace osmwave {
+    inline unsigned int thread_count() {
+        unsigned int n = std::thread::hardware_concurrency();
+        return n ? n : 1;
+    }
+
+    // Splits [0, n) into one contiguous slice per thread and calls
+    // fn(begin, end) for each slice. Small ranges are run on the calling
+    // thread, since starting threads costs more than the work.
+    template <typename F>
+    void parallel_for(size_t n, const F& fn, size_t minSlice = 4096) {
+        size_t threads = std::min<size_t>(thread_count(), std::max<size_t>(1, n / minSlice));
+        if (threads <= 1) {
+            fn(0, n);
+            return;
+        }
+
+        std::vector<std::thread> workers;
+        size_t slice = (n + threads - 1) / threads;
+        for (size_t begin = 0; begin < n; begin += slice) {
+            size_t end = std::min(n, begin + slice);
+            workers.push_back(std::thread([&fn, begin, end]() { fn(begin, end); }));
+        }
+
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    }
+
+    // Fixed set of worker threads running submitted tasks in FIFO order.
+    class ThreadPool {
+        std::vector<std::thread> workers;
+        std::deque<std::function<void()>> tasks;
+        std::mutex mutex;
+        std::condition_variable available;
+        bool stopping;
+
+    public:
+        ThreadPool(unsigned int threads = thread_count()) : stopping(false) {
+            for (unsigned int i = 0; i < threads; i++) {
+                workers.push_back(std::thread([this]() { run(); }));
+            }
+        }
+
+        ~ThreadPool() {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+            }
+            available.notify_all();
+            for (auto& worker : workers) {
+                worker.join();
+            }
+        }
+
+        size_t size() const { return workers.size(); }
+
+        template <typename F>
+        std::future<typename std::result_of<F()>::type> submit(F task) {
+            typedef typename std::result_of<F()>::type result_type;
+            auto packaged = std::make_shared<std::packaged_task<result_type()>>(std::move(task));
+            std::future<result_type> result = packaged->get_future();
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                tasks.push_back([packaged]() { (*packaged)(); });
+            }
+            available.notify_one();
+            return result;
+        }
+
+    private:
+        void run() {
+            for (;;) {
+                std::function<void()> task;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    available.wait(lock, [this]() { return stopping || !tasks.empty(); });
+                    if (tasks.empty()) {
+                        return;
+                    }
+                    task = std::move(tasks.front());
+                    tasks.pop_front();
+                }
+                task();
+            }
+        }
+    };
+}
+
+#endif
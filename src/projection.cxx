@@ -0,0 +1,263 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include "projection.hxx"
+
+using namespace std;
+
+namespace osmwave {
+    // WGS84 ellipsoid
+    const double WGS84_A = 6378137;
+    const double WGS84_ES = (2 - 1 / 298.257223563) / 298.257223563;
+    const double WGS84_ESP = WGS84_ES / (1 - WGS84_ES);
+
+    // Series coefficients, from proj's pj_mlfn.c and PJ_tmerc.c
+    const double C00 = 1.;
+    const double C02 = .25;
+    const double C04 = .046875;
+    const double C06 = .01953125;
+    const double C08 = .01068115234375;
+    const double C22 = .75;
+    const double C44 = .46875;
+    const double C46 = .01302083333333333333;
+    const double C48 = .00712076822916666666;
+    const double C66 = .36458333333333333333;
+    const double C68 = .00569661458333333333;
+    const double C88 = .3076171875;
+
+    const double FC1 = 1.;
+    const double FC2 = .5;
+    const double FC3 = .16666666666666666666;
+    const double FC4 = .08333333333333333333;
+    const double FC5 = .05;
+    const double FC6 = .03333333333333333333;
+    const double FC7 = .02380952380952380952;
+    const double FC8 = .01785714285714285714;
+
+    // proj stops iterating the inverse meridian distance at 1e-10 radians,
+    // which this many iterations always reach for latitudes below 85
+    // degrees; a fixed count, unrolled, keeps the loop free of branches.
+    const int INV_MLFN_ITERATIONS = 5;
+
+    // Tolerance proj's tmerc uses for the cosine at the poles
+    const double EPS10 = 1e-10;
+    const double HALF_PI = M_PI / 2;
+
+    // Taylor coefficients of sin, -1/3!, 1/5!, ... -1/23!
+    const double SIN_COEFFICIENTS[] = {
+        -1.66666666666666666667e-1, 8.33333333333333333333e-3, -1.98412698412698412698e-4,
+        2.75573192239858906526e-6, -2.50521083854417187751e-8, 1.60590438368216145994e-10,
+        -7.64716373181981647590e-13, 2.81145725434552076320e-15, -8.22063524662432971696e-18,
+        1.95729410633912612308e-20, -3.86817017063068403773e-23, 6.44695028438447339621e-26
+    };
+    const int SIN_TERMS = sizeof(SIN_COEFFICIENTS) / sizeof(SIN_COEFFICIENTS[0]);
+
+    // sin for |x| <= pi, folded into [-pi/2, pi/2], where the polynomial
+    // is within 1e-20 of sin; results match the C library's to a few units
+    // in the last place. Unlike the C library's opaque call, which keeps
+    // the loops below from vectorizing, this is inline and branch free.
+    static inline double poly_sin(double x) {
+        x = max(min(x, M_PI - x), -M_PI - x);
+        double x2 = x * x;
+        double p = SIN_COEFFICIENTS[SIN_TERMS - 1];
+        #pragma GCC unroll 12
+        for (int i = SIN_TERMS - 2; i >= 0; i--) {
+            p = p * x2 + SIN_COEFFICIENTS[i];
+        }
+        return x + x * x2 * p;
+    }
+
+    // Meridian distance on the unit ellipsoid. Latitudes are within
+    // +-90 degrees, so the cosine is taken from the sine, which leaves a
+    // single sine per point, computed inline by poly_sin.
+    static inline double mlfn(double phi, double sinphi, double cosphi, const double* en) {
+        cosphi *= sinphi;
+        sinphi *= sinphi;
+        return en[0] * phi - cosphi * (en[1] + sinphi * (en[2] + sinphi * (en[3] + sinphi * en[4])));
+    }
+
+    Projection::Projection(const std::string& def) : def(def), fast(false), lam0(0), x0(0), y0(0), k0(1), ml0(0) {
+        ctx = pj_ctx_alloc();
+        proj = pj_init_plus_ctx(ctx, def.c_str());
+        wgs84 = pj_init_plus_ctx(ctx, "+proj=longlat +ellps=WGS84 +datum=WGS84 +no_defs");
+
+        double es = WGS84_ES, t;
+        en[0] = C00 - es * (C02 + es * (C04 + es * (C06 + es * C08)));
+        en[1] = es * (C22 - es * (C04 + es * (C06 + es * C08)));
+        en[2] = (t = es * es) * (C44 - es * (C46 + es * C48));
+        en[3] = (t *= es) * (C66 - es * C68);
+        en[4] = t * es * C88;
+
+        fast = proj && parseTmerc(def);
+    }
+
+    Projection::~Projection() {
+        if (proj) {
+            pj_free(proj);
+        }
+        pj_free(wgs84);
+        pj_ctx_free(ctx);
+    }
+
+    // Accepts the parameters get_proj uses, and nothing else
+    bool Projection::parseTmerc(const std::string& def) {
+        istringstream tokens(def);
+        string token;
+        bool tmerc = false, wgs84Ellipsoid = false;
+        double lat0 = 0, lon0 = 0;
+
+        while (tokens >> token) {
+            if (token[0] != '+') {
+                return false;
+            }
+
+            size_t eq = token.find('=');
+            string key = token.substr(1, eq == string::npos ? string::npos : eq - 1);
+            string value = eq == string::npos ? "" : token.substr(eq + 1);
+
+            double number = 0;
+            bool isNumber = false;
+            if (!value.empty()) {
+                char* end;
+                number = strtod(value.c_str(), &end);
+                isNumber = *end == '\0';
+            }
+
+            if (key == "proj") {
+                tmerc = value == "tmerc";
+            } else if (key == "ellps" || key == "datum") {
+                wgs84Ellipsoid = value == "WGS84";
+                if (!wgs84Ellipsoid) {
+                    return false;
+                }
+            } else if (key == "towgs84") {
+                if (value != "0,0,0") {
+                    return false;
+                }
+            } else if (key == "units") {
+                if (value != "m") {
+                    return false;
+                }
+            } else if (key == "no_defs") {
+            } else if (key == "lat_0" && isNumber) {
+                lat0 = number;
+            } else if (key == "lon_0" && isNumber) {
+                lon0 = number;
+            } else if ((key == "k" || key == "k_0") && isNumber) {
+                k0 = number;
+            } else if (key == "x_0" && isNumber) {
+                x0 = number;
+            } else if (key == "y_0" && isNumber) {
+                y0 = number;
+            } else {
+                return false;
+            }
+        }
+
+        if (!tmerc || !wgs84Ellipsoid) {
+            return false;
+        }
+
+        lam0 = lon0 * DEG_TO_RAD;
+        double phi0 = lat0 * DEG_TO_RAD;
+        ml0 = mlfn(phi0, sin(phi0), cos(phi0), en);
+        return true;
+    }
+
+    void Projection::forward(double* coords, size_t n) const {
+        if (!fast) {
+            pj_transform(wgs84, proj, n, 2, coords, coords + 1, nullptr);
+            return;
+        }
+
+        const double es = WGS84_ES, esp = WGS84_ESP;
+        const double lam0 = this->lam0, ml0 = this->ml0, k0 = this->k0;
+        const double ka = k0 * WGS84_A, x0 = this->x0, y0 = this->y0;
+        const double e[] = {en[0], en[1], en[2], en[3], en[4]};
+
+        for (size_t i = 0; i < n; i++) {
+            double lam = coords[i * 2] - lam0;
+            double phi = coords[i * 2 + 1];
+
+            // Like proj, points more than 90 degrees from the central
+            // meridian have no projection, and the tangent of the
+            // latitude is taken as 0 at the poles
+            double sinphi = poly_sin(phi);
+            double cosphi = sqrt(1 - sinphi * sinphi);
+            double t = fabs(cosphi) > EPS10 ? sinphi / cosphi : 0;
+            t *= t;
+            double al = cosphi * lam;
+            double als = al * al;
+            al /= sqrt(1 - es * sinphi * sinphi);
+            double nn = esp * cosphi * cosphi;
+
+            double x = al * (FC1 +
+                FC3 * als * (1 - t + nn +
+                FC5 * als * (5 + t * (t - 18) + nn * (14 - 58 * t) +
+                FC7 * als * (61 + t * (t * (179 - t) - 479)))));
+            double y = mlfn(phi, sinphi, cosphi, e) - ml0 +
+                sinphi * al * lam * FC2 * (1 +
+                FC4 * als * (5 - t + nn * (9 + 4 * nn) +
+                FC6 * als * (61 + t * (t - 58) + nn * (270 - 330 * t) +
+                FC8 * als * (1385 + t * (t * (543 - t) - 3111)))));
+
+            bool valid = fabs(lam) <= HALF_PI;
+            coords[i * 2] = valid ? ka * x + x0 : HUGE_VAL;
+            coords[i * 2 + 1] = valid ? ka * y + y0 : HUGE_VAL;
+        }
+    }
+
+    void Projection::inverse(double* coords, size_t n) const {
+        if (!fast) {
+            pj_transform(proj, wgs84, n, 2, coords, coords + 1, nullptr);
+            return;
+        }
+
+        const double es = WGS84_ES, esp = WGS84_ESP, k = 1 / (1 - es);
+        const double lam0 = this->lam0, ml0 = this->ml0, k0 = this->k0;
+        const double ra = 1 / WGS84_A, x0 = this->x0, y0 = this->y0;
+        const double e[] = {en[0], en[1], en[2], en[3], en[4]};
+
+        for (size_t i = 0; i < n; i++) {
+            double x = (coords[i * 2] - x0) * ra;
+            double y = (coords[i * 2 + 1] - y0) * ra;
+
+            // Footpoint latitude, from the meridian distance
+            double arg = ml0 + y / k0;
+            double phi = arg;
+            #pragma GCC unroll 5
+            for (int j = 0; j < INV_MLFN_ITERATIONS; j++) {
+                double s = poly_sin(phi);
+                double c = sqrt(1 - s * s);
+                double u = 1 - es * s * s;
+                phi -= (mlfn(phi, s, c, e) - arg) * (u * sqrt(u)) * k;
+            }
+
+            // Footpoints at the poles project to the pole, as in proj
+            bool pole = fabs(phi) >= HALF_PI;
+            double sinphi = poly_sin(phi);
+            double cosphi = sqrt(1 - sinphi * sinphi);
+            double t = fabs(cosphi) > EPS10 ? sinphi / cosphi : 0;
+            double nn = esp * cosphi * cosphi;
+            double con = 1 - es * sinphi * sinphi;
+            double d = x * sqrt(con) / k0;
+            con *= t;
+            t *= t;
+            double ds = d * d;
+
+            phi -= (con * ds / (1 - es)) * FC2 * (1 -
+                ds * FC4 * (5 + t * (3 - 9 * nn) + nn * (1 - 4 * nn) -
+                ds * FC6 * (61 + t * (90 - 252 * nn + 45 * t) + 46 * nn -
+                ds * FC8 * (1385 + t * (3633 + t * (4095 + 1574 * t))))));
+            double lam = d * (FC1 -
+                ds * FC3 * (1 + 2 * t + nn -
+                ds * FC5 * (5 + t * (28 + 24 * t + 8 * nn) + 6 * nn -
+                ds * FC7 * (61 + t * (662 + t * (1320 + 720 * t)))))) / max(cosphi, EPS10);
+
+            coords[i * 2] = pole ? lam0 : lam + lam0;
+            coords[i * 2 + 1] = pole ? copysign(HALF_PI, y) : phi;
+        }
+    }
+}
@@ -0,0 +1,353 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cerrno>
+#include <vector>
+#include <sys/stat.h>
+#include "quantizedmesh.hxx"
+#include "parallel.hxx"
+
+using namespace std;
+
+namespace osmwave {
+    const int QUANTIZED_MAX = 32767;
+    const int GRID_CELLS = QUANTIZED_MESH_GRID - 1;
+
+    // WGS84 ellipsoid, for the ECEF positions in the tile header
+    const double ELLIPSOID_A = 6378137.0;
+    const double ELLIPSOID_B = 6356752.3142451793;
+    const double ELLIPSOID_E2 = 1 - (ELLIPSOID_B * ELLIPSOID_B) / (ELLIPSOID_A * ELLIPSOID_A);
+
+    static_assert(QUANTIZED_MESH_GRID * QUANTIZED_MESH_GRID <= 65536, "tiles are written with 16 bit indices");
+
+    struct Vec3 {
+        double x;
+        double y;
+        double z;
+    };
+
+    static Vec3 to_ecef(double lat, double lon, double height) {
+        double phi = lat * M_PI / 180, lambda = lon * M_PI / 180;
+        double sinPhi = sin(phi), cosPhi = cos(phi);
+        double n = ELLIPSOID_A / sqrt(1 - ELLIPSOID_E2 * sinPhi * sinPhi);
+        Vec3 p = {
+            (n + height) * cosPhi * cos(lambda),
+            (n + height) * cosPhi * sin(lambda),
+            (n * (1 - ELLIPSOID_E2) + height) * sinPhi
+        };
+        return p;
+    }
+
+    // Values are written as is, which assumes a little endian machine,
+    // like the format itself
+    template <typename T>
+    static void put(string& out, T value) {
+        out.append((const char*)&value, sizeof(T));
+    }
+
+    static inline uint16_t zigzag(int value) {
+        return (uint16_t)(((unsigned)value << 1) ^ (unsigned)(value >> 31));
+    }
+
+    // Height at grid vertex (r, c), counted globally from the south west
+    // corner of the tiling. If the grid is coarser than the elevation data,
+    // the mean of the data samples in the vertex's cell, so that coarse
+    // levels are built from all of the data at lower resolution rather
+    // than point samples. Cell edges are computed the same way for
+    // neighbouring cells, so every sample counts for exactly one vertex.
+    static double grid_height(const Elevation& elevation, double samplesPerDegree, int64_t r, int64_t c, double cellSize) {
+        double lat = -90 + r * cellSize, lon = -180 + c * cellSize;
+        if (cellSize * samplesPerDegree <= 1) {
+            return elevation.contains(lat, lon) ? elevation.elevation(lat, lon) : 0;
+        }
+
+        // Samples within the cell and the elevation data, half open
+        double south = max(-90 + (r - 0.5) * cellSize, elevation.getSouth());
+        double north = min(-90 + (r + 0.5) * cellSize, elevation.getNorth());
+        double west = max(-180 + (c - 0.5) * cellSize, elevation.getWest());
+        double east = min(-180 + (c + 0.5) * cellSize, elevation.getEast());
+        int64_t i1 = (int64_t)ceil(south * samplesPerDegree), i2 = (int64_t)ceil(north * samplesPerDegree);
+        int64_t j1 = (int64_t)ceil(west * samplesPerDegree), j2 = (int64_t)ceil(east * samplesPerDegree);
+
+        double sum = 0;
+        int64_t count = 0;
+        for (int64_t i = i1; i < i2; i++) {
+            double sLat = i / samplesPerDegree;
+            for (int64_t j = j1; j < j2; j++) {
+                sum += elevation.elevation(sLat, j / samplesPerDegree);
+                count++;
+            }
+        }
+
+        return count ? sum / count : 0;
+    }
+
+    // Distance, in ellipsoid scaled space, along direction at which a
+    // point is just visible whenever position is, as in Cesium's
+    // EllipsoidalOccluder; negative if there is no such distance.
+    static double horizon_magnitude(const Vec3& position, const Vec3& direction) {
+        Vec3 scaled = {position.x / ELLIPSOID_A, position.y / ELLIPSOID_A, position.z / ELLIPSOID_B};
+        double magnitudeSquared = scaled.x * scaled.x + scaled.y * scaled.y + scaled.z * scaled.z;
+        double magnitude = sqrt(magnitudeSquared);
+        Vec3 d = {scaled.x / magnitude, scaled.y / magnitude, scaled.z / magnitude};
+
+        // Points below the ellipsoid count as on it
+        magnitudeSquared = max(1.0, magnitudeSquared);
+        magnitude = max(1.0, magnitude);
+
+        double cosAlpha = d.x * direction.x + d.y * direction.y + d.z * direction.z;
+        Vec3 cross = {
+            d.y * direction.z - d.z * direction.y,
+            d.z * direction.x - d.x * direction.z,
+            d.x * direction.y - d.y * direction.x
+        };
+        double sinAlpha = sqrt(cross.x * cross.x + cross.y * cross.y + cross.z * cross.z);
+        double cosBeta = 1 / magnitude;
+        double sinBeta = sqrt(magnitudeSquared - 1) * cosBeta;
+
+        return 1 / (cosAlpha * cosBeta - sinAlpha * sinBeta);
+    }
+
+    string encode_quantized_mesh(const Elevation& elevation, int zoom, int x, int y) {
+        const int nVerts = QUANTIZED_MESH_GRID * QUANTIZED_MESH_GRID;
+        double tileSize = 180.0 / (1 << zoom);
+        double cellSize = tileSize / GRID_CELLS;
+        double west = -180 + x * tileSize;
+        double south = -90 + y * tileSize;
+
+        // Grid vertices, row by row from the south west corner. Positions
+        // are computed from global grid coordinates, so that neighbouring
+        // tiles get exactly the same edge vertices.
+        double samplesPerDegree = round(1 / elevation.resolution());
+        vector<double> heights(nVerts);
+        for (int r = 0; r < QUANTIZED_MESH_GRID; r++) {
+            for (int c = 0; c < QUANTIZED_MESH_GRID; c++) {
+                heights[r * QUANTIZED_MESH_GRID + c] = grid_height(elevation, samplesPerDegree,
+                    (int64_t)y * GRID_CELLS + r, (int64_t)x * GRID_CELLS + c, cellSize);
+            }
+        }
+
+        float minHeight = (float)*min_element(heights.begin(), heights.end());
+        float maxHeight = (float)*max_element(heights.begin(), heights.end());
+
+        // Two counter clockwise triangles per grid cell
+        vector<int> triangles;
+        triangles.reserve(GRID_CELLS * GRID_CELLS * 6);
+        for (int r = 0; r < GRID_CELLS; r++) {
+            for (int c = 0; c < GRID_CELLS; c++) {
+                int a = r * QUANTIZED_MESH_GRID + c;
+                int b = a + 1;
+                int d = a + QUANTIZED_MESH_GRID;
+                int e = d + 1;
+                int tri[] = {a, b, e, a, e, d};
+                triangles.insert(triangles.end(), tri, tri + 6);
+            }
+        }
+
+        // Vertices are renumbered in order of first use, which the high
+        // water mark encoding of the indices relies on
+        vector<int> renumbered(nVerts, -1);
+        vector<int> order;
+        order.reserve(nVerts);
+        for (int& index : triangles) {
+            if (renumbered[index] < 0) {
+                renumbered[index] = order.size();
+                order.push_back(index);
+            }
+            index = renumbered[index];
+        }
+
+        vector<uint16_t> us(nVerts), vs(nVerts), hs(nVerts);
+        double heightRange = maxHeight - minHeight;
+        for (int i = 0; i < nVerts; i++) {
+            int grid = order[i];
+            us[i] = (uint16_t)lround((double)(grid % QUANTIZED_MESH_GRID) * QUANTIZED_MAX / GRID_CELLS);
+            vs[i] = (uint16_t)lround((double)(grid / QUANTIZED_MESH_GRID) * QUANTIZED_MAX / GRID_CELLS);
+            hs[i] = heightRange > 0 ? (uint16_t)lround((heights[grid] - minHeight) / heightRange * QUANTIZED_MAX) : 0;
+        }
+
+        Vec3 center = to_ecef(south + tileSize / 2, west + tileSize / 2, (minHeight + maxHeight) / 2.0);
+        double radius = 0;
+        Vec3 direction = {center.x / ELLIPSOID_A, center.y / ELLIPSOID_A, center.z / ELLIPSOID_B};
+        double directionLength = sqrt(direction.x * direction.x + direction.y * direction.y + direction.z * direction.z);
+        direction.x /= directionLength;
+        direction.y /= directionLength;
+        direction.z /= directionLength;
+        double horizon = 0;
+        bool horizonValid = true;
+
+        for (int r = 0; r < QUANTIZED_MESH_GRID; r++) {
+            double lat = -90 + (double)(y * GRID_CELLS + r) * cellSize;
+            for (int c = 0; c < QUANTIZED_MESH_GRID; c++) {
+                double lon = -180 + (double)(x * GRID_CELLS + c) * cellSize;
+                Vec3 p = to_ecef(lat, lon, heights[r * QUANTIZED_MESH_GRID + c]);
+                double dx = p.x - center.x, dy = p.y - center.y, dz = p.z - center.z;
+                radius = max(radius, sqrt(dx * dx + dy * dy + dz * dz));
+
+                double magnitude = horizon_magnitude(p, direction);
+                if (magnitude > 0 && std::isfinite(magnitude)) {
+                    horizon = max(horizon, magnitude);
+                } else {
+                    horizonValid = false;
+                }
+            }
+        }
+
+        // Tiles spanning much of the globe have no occlusion point; one far
+        // out along the center direction keeps them from being culled
+        if (!horizonValid) {
+            horizon = 1e6;
+        }
+
+        string out;
+        out.reserve(88 + 4 + nVerts * 6 + 4 + triangles.size() * 2 + 16 + 8 * QUANTIZED_MESH_GRID);
+
+        put(out, center.x);
+        put(out, center.y);
+        put(out, center.z);
+        put(out, minHeight);
+        put(out, maxHeight);
+        put(out, center.x);
+        put(out, center.y);
+        put(out, center.z);
+        put(out, radius);
+        put(out, direction.x * horizon);
+        put(out, direction.y * horizon);
+        put(out, direction.z * horizon);
+
+        put(out, (uint32_t)nVerts);
+        for (auto values : {&us, &vs, &hs}) {
+            int last = 0;
+            for (uint16_t value : *values) {
+                put(out, zigzag((int)value - last));
+                last = value;
+            }
+        }
+
+        put(out, (uint32_t)(triangles.size() / 3));
+        int highest = 0;
+        for (int index : triangles) {
+            int code = highest - index;
+            put(out, (uint16_t)code);
+            if (code == 0) {
+                highest++;
+            }
+        }
+
+        // West, south, east and north edge vertices, along the edge
+        for (int edge = 0; edge < 4; edge++) {
+            put(out, (uint32_t)QUANTIZED_MESH_GRID);
+            for (int i = 0; i < QUANTIZED_MESH_GRID; i++) {
+                int r, c;
+                switch (edge) {
+                case 0: r = i; c = 0; break;
+                case 1: r = 0; c = i; break;
+                case 2: r = i; c = GRID_CELLS; break;
+                default: r = GRID_CELLS; c = i; break;
+                }
+                put(out, (uint16_t)renumbered[r * QUANTIZED_MESH_GRID + c]);
+            }
+        }
+
+        return out;
+    }
+
+    static bool make_directory(const string& path) {
+        return mkdir(path.c_str(), 0755) == 0 || errno == EEXIST;
+    }
+
+    struct TileId {
+        int zoom;
+        int x;
+        int y;
+    };
+
+    bool write_quantized_mesh_tiles(const Elevation& elevation, const string& dir, int maxZoom, double x1, double y1, double x2, double y2) {
+        if (!make_directory(dir)) {
+            cerr << "Unable to create directory " << dir << endl;
+            return false;
+        }
+
+        vector<TileId> tiles;
+        ostringstream available;
+        available << "[";
+        for (int zoom = 0; zoom <= maxZoom; zoom++) {
+            double tileSize = 180.0 / (1 << zoom);
+            int xEnd = (2 << zoom) - 1, yEnd = (1 << zoom) - 1;
+            int startX = max(0, (int)floor((x1 + 180) / tileSize));
+            int startY = max(0, (int)floor((y1 + 90) / tileSize));
+            int endX = min(xEnd, (int)ceil((x2 + 180) / tileSize) - 1);
+            int endY = min(yEnd, (int)ceil((y2 + 90) / tileSize) - 1);
+            if (zoom == 0) {
+                startX = startY = 0;
+                endX = xEnd;
+                endY = yEnd;
+            }
+
+            available << (zoom ? ", " : "") << "[";
+            available << "{\"startX\": " << startX << ", \"startY\": " << startY << ", \"endX\": " << endX << ", \"endY\": " << endY << "}";
+            available << "]";
+
+            ostringstream zoomDir;
+            zoomDir << dir << '/' << zoom;
+            make_directory(zoomDir.str());
+            for (int x = startX; x <= endX; x++) {
+                ostringstream xDir;
+                xDir << zoomDir.str() << '/' << x;
+                make_directory(xDir.str());
+                for (int y = startY; y <= endY; y++) {
+                    TileId tile = {zoom, x, y};
+                    tiles.push_back(tile);
+                }
+            }
+        }
+        available << "]";
+
+        cerr << "Writing " << tiles.size() << " terrain tiles..." << endl;
+        atomic<size_t> failed(0);
+        parallel_for(tiles.size(), [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                const TileId& tile = tiles[i];
+                string data = encode_quantized_mesh(elevation, tile.zoom, tile.x, tile.y);
+
+                ostringstream path;
+                path << dir << '/' << tile.zoom << '/' << tile.x << '/' << tile.y << ".terrain";
+                ofstream file(path.str().c_str(), ios::out | ios::binary | ios::trunc);
+                file.write(data.data(), data.size());
+                if (!file) {
+                    failed++;
+                }
+            }
+        }, 1);
+
+        if (failed) {
+            cerr << "Unable to write " << failed << " tiles to " << dir << endl;
+        }
+
+        ofstream layer((dir + "/layer.json").c_str());
+        layer << "{\n"
+            << "  \"tilejson\": \"2.1.0\",\n"
+            << "  \"name\": \"osmwave\",\n"
+            << "  \"version\": \"1.0.0\",\n"
+            << "  \"format\": \"quantized-mesh-1.0\",\n"
+            << "  \"scheme\": \"tms\",\n"
+            << "  \"tiles\": [\"{z}/{x}/{y}.terrain?v={version}\"],\n"
+            << "  \"projection\": \"EPSG:4326\",\n"
+            << "  \"bounds\": [" << x1 << ", " << y1 << ", " << x2 << ", " << y2 << "],\n"
+            << "  \"minzoom\": 0,\n"
+            << "  \"maxzoom\": " << maxZoom << ",\n"
+            << "  \"available\": " << available.str() << "\n"
+            << "}\n";
+
+        if (!layer) {
+            cerr << "Unable to write " << dir << "/layer.json" << endl;
+            return false;
+        }
+
+        return failed == 0;
+    }
+}
@@ -0,0 +1,29 @@
+#ifndef __QUANTIZEDMESH_HXX__
+#define __QUANTIZEDMESH_HXX__
+
+#include <string>
+#include "elevation.hxx"
+
+using namespace std;
+
+namespace osmwave {
+    // Vertices along each side of a tile
+    const int QUANTIZED_MESH_GRID = 65;
+
+    // Encodes tile (x, y) at zoom level zoom of the geographic TMS tiling
+    // (two tiles at level 0, y counted from the south) in the
+    // quantized-mesh-1.0 format, as a regular grid of heights. When the
+    // grid is coarser than the elevation data, every height is the mean
+    // of the data within its grid cell. Heights of cells without data are
+    // zero.
+    string encode_quantized_mesh(const Elevation& elevation, int zoom, int x, int y);
+
+    // Writes the tiles at zoom levels 0 to maxZoom covering the lat/lng box
+    // (x1, y1) - (x2, y2) to dir/z/x/y.terrain, in parallel, along with the
+    // layer.json describing them. Every level is written, and both level 0
+    // tiles, since clients start from those and only load the children of
+    // tiles they have. Returns false if any file could not be written.
+    bool write_quantized_mesh_tiles(const Elevation& elevation, const string& dir, int maxZoom, double x1, double y1, double x2, double y2);
+}
+
+#endif
@@ -4,168 +4,39 @@
 #include <proj_api.h>
 #include "elevation.hxx"
 #include "ObjWriter.hxx"
-#include "Delaunay.h"
+#include "terrainmesh.hxx"
+#include "localframe.hxx"
+#include "projection.hxx"
+#include "outputstream.hxx"
+#include "quantizedmesh.hxx"
 
 using namespace std;
 using namespace osmwave;
 
-static projPJ wgs84 = pj_init_plus("+proj=longlat +ellps=WGS84 +datum=WGS84 +no_defs");
+template <typename Real>
+void build_and_write(ObjWriter& writer, const Elevation& elevation, const std::string& projDef, const LocalFrame& frame, bool optimize, double x1, double y1, double x2, double y2) {
+    BasicTerrainMesh<Real> mesh;
 
-// Note: in place addition
-static void vecAdd(XYZ& a, const XYZ& b) {
-    a.x += b.x;
-    a.y += b.y;
-    a.z += b.z;
+    build_terrain(mesh, elevation, projDef, frame, x1, y1, x2, y2);
+    write_terrain(writer, mesh, optimize);
 }
 
-static void vecSub(const XYZ& a, const XYZ& b, XYZ& result) {
-    result.x = a.x - b.x;
-    result.y = a.y - b.y;
-    result.z = a.z - b.z;
-}
-
-static void triangleNormal(const XYZ* coords, const ITRIANGLE& tri, XYZ& normal) {
-    XYZ u;
-    XYZ v;
-
-    vecSub(coords[tri.p2], coords[tri.p1], u);
-    vecSub(coords[tri.p3], coords[tri.p1], v);
-
-    normal.x = u.y*v.z - u.z*v.y;
-    normal.y = u.z*v.x - u.x*v.z;
-    normal.z = u.x*v.y - u.y*v.x;
-
-    double l = sqrt(normal.x*normal.x+normal.y*normal.y+normal.z*normal.z);
-
-    normal.x = normal.x / l;
-    normal.y = normal.y / l;
-    normal.z = normal.z / l;
-}
-
-static double findNearHeight(int rows, int cols, int index, int dx, int dy, XYZ* verts) {
-    int s = index;
-    do {
-        s += dx * rows + dy;
-    } while (std::isnan(verts[s].z));
-
-    return verts[s].z;
-}
-
-static int thin(int rows, int cols, XYZ* verts, double tolerance) {
-    int index = 0;
-    int nonEmpty = 0;
-
-    for (int i = 1; i < cols - 1; i++) {
-        for (int j = 1; j < rows - 1; j++) {
-            if (!std::isnan(verts[index].z)) {
-                double e1 = verts[index].z;
-                double e2 = findNearHeight(rows, cols, index, 1, -1, verts);
-                double e3 = findNearHeight(rows, cols, index, 1, 0, verts);
-                double e4 = findNearHeight(rows, cols, index, 1, 1, verts);
-                double d2 = abs(e1 - e2);
-                double d3 = abs(e1 - e3);
-                double d4 = abs(e1 - e4);
-
-                if (d2 <= tolerance &&
-                    d3 <= tolerance &&
-                    d4 <= tolerance) {
-                    verts[index].z = NAN;
-                } else {
-                    nonEmpty++;
-                }
-            }
-
-            index++;
-        }
-    }
-
-    return nonEmpty;
-}
-
-void terrain_to_obj(const std::string& elevationPath, const std::string& projDef, double x1, double y1, double x2, double y2) {
+void terrain_to_obj(ostream& out, const std::string& elevationPath, const std::string& projDef, bool singlePrecision, bool optimize, double x1, double y1, double x2, double y2) {
     Elevation elevation(floor(y1), floor(x1), ceil(y2), ceil(x2), elevationPath);
-    ObjWriter writer(cout);
-    projPJ proj = pj_init_plus(projDef.c_str());
-    double step = 1.0 / 3600;
-    int rows = (int)floor((y2 - y1) / step + 1);
-    int cols = (int)floor((x2 - x1) / step + 1);
-    double bounds[] = {x1*DEG_TO_RAD, y1*DEG_TO_RAD, x2*DEG_TO_RAD, y2*DEG_TO_RAD};
-
-    pj_transform(wgs84, proj, 2, 2, (double*)&bounds, (double*)&bounds + 1, nullptr);
-
-    cerr << "rows: " << rows << ", cols: " << cols << endl;
-    cerr << "bounds: " << bounds[0] << ", " << bounds[1] << " - " << bounds[2] << ", " << bounds[3] << endl;
-
-    cerr << "Calculating vertices..." << endl;
-    XYZ* coords = new XYZ[rows * cols + 3];
-    XYZ* normals = new XYZ[rows * cols];
-
-    int i = 0;
-    // Having columns as outer loop ensures x will be growing,
-    // which is a requirement for the triangulation algorithm,
-    // as long as projection is west to east.
-    for (int c = 0; c < cols; c++) {
-        double x = bounds[0] + (bounds[2] - bounds[0]) * c / cols;
-        for (int r = 0; r < rows; r++) {
-            double y = bounds[1] + (bounds[3] - bounds[1]) * r / rows;
-            double ll[2] = {x, y};
-            pj_transform(proj, wgs84, 1, 2, (double*)&ll, (double*)&ll + 1, nullptr);
-
-            XYZ& coord = coords[i++];
-            coord.x = x;
-            coord.y = y;
-            coord.z = elevation.elevation(ll[1]*RAD_TO_DEG, ll[0]*RAD_TO_DEG);
-
-            //cerr << (ll[0] * RAD_TO_DEG) << ", " << (ll[1] * RAD_TO_DEG) << " (" << coord.x << ", " << coord.y << "): " << coord.z << endl;
-        }
-    }
-
-    int startCount = rows * cols,
-        lastCount = 0,
-        count = -1;
-    cerr << "Thinning " << startCount << " vertices..." << endl;
-    while (lastCount != count) {
-        lastCount = count;
-        count = thin(rows, cols, coords, 2);
-    }
-
-    int j = 0;
-    for (int i = 0; i < rows * cols; i++) {
-        if (!std::isnan(coords[i].z)) {
-            coords[j++] = coords[i];
-        }
-    }
-    cerr << "Thinned to " << j << " vertices" << endl;
-
-    cerr << "Triangulating..." << endl;
-    ITRIANGLE *tris = new ITRIANGLE[3 * rows * cols];
-    int numTriangles;
-    Triangulate(j, coords, tris, numTriangles);
-    cerr << numTriangles << " triangles" << endl;
-
-    memset((void*)normals, 0, sizeof(XYZ) * j);
-    for (int i = 0; i < numTriangles; i++) {
-        XYZ normal;
-        triangleNormal(coords, tris[i], normal);
-        vecAdd(normals[tris[i].p1], normal);
-        vecAdd(normals[tris[i].p2], normal);
-        vecAdd(normals[tris[i].p3], normal);
-    }
+    ObjWriter writer(out);
 
-    writer.checkpoint();
-    for (int i = 0; i < j; i++) {
-        writer.vertex(coords[i].y, coords[i].z, coords[i].x, normals[i].y, normals[i].z, normals[i].x);
+    LocalFrame frame;
+    if (singlePrecision) {
+        Projection projection(projDef);
+        frame = LocalFrame::forBounds(projection, x1, y1, x2, y2, true);
     }
 
-    for (int i = 0; i < numTriangles; i++) {
-        writer.beginFace();
-        writer << tris[i].p1 << tris[i].p2 << tris[i].p3;
-        writer.endFace();
+    if (frame.single) {
+        writer.comment(frame.comment());
+        build_and_write<float>(writer, elevation, projDef, frame, optimize, x1, y1, x2, y2);
+    } else {
+        build_and_write<double>(writer, elevation, projDef, frame, optimize, x1, y1, x2, y2);
     }
-
-    delete coords;
-    delete normals;
-    delete tris;
 }
 
 int main(int argc, char* argv[]) {
@@ -174,6 +45,11 @@ int main(int argc, char* argv[]) {
     desc.add_options()
         ("elevation_dir,e", po::value<string>()->required(), "Set directory containing elevation data")
         ("proj,p", po::value<string>(), "Projection definition")
+        ("output,o", po::value<string>()->default_value("-"), "Output file, compressed if name ends with .gz or .zst")
+        ("optimize-mesh", "Order triangles and vertices for faster rendering")
+        ("float", "Keep the terrain mesh in single precision, relative to a local origin, if precise enough for the extent")
+        ("tiles", po::value<string>(), "Write a quantized-mesh-1.0 tile pyramid to this directory instead of an OBJ")
+        ("max-zoom", po::value<int>()->default_value(13), "Highest zoom level of the tile pyramid")
         ("x1", po::value<double>()->required(), "X1")
         ("y1", po::value<double>()->required(), "Y1")
         ("x2", po::value<double>()->required(), "X2")
@@ -205,6 +81,18 @@ int main(int argc, char* argv[]) {
     const double x2 = vm["x2"].as<double>();
     const double y2 = vm["y2"].as<double>();
 
+    if (vm.count("tiles")) {
+        int maxZoom = vm["max-zoom"].as<int>();
+        if (maxZoom < 0 || maxZoom > 24) {
+            cerr << "Error invalid zoom level " << maxZoom << endl << endl;
+            cerr << desc << endl;
+            return 1;
+        }
+
+        Elevation elevation(floor(y1), floor(x1), ceil(y2), ceil(x2), elevPath);
+        return write_quantized_mesh_tiles(elevation, vm["tiles"].as<string>(), maxZoom, x1, y1, x2, y2) ? 0 : 1;
+    }
+
     if (vm.count("proj")) {
         projDef = &vm["proj"].as<string>();
     } else {
@@ -213,8 +101,13 @@ int main(int argc, char* argv[]) {
         projDef = new string(stream.str());
     }
 
-    terrain_to_obj(elevPath, *projDef, x1, y1, x2, y2);
+    OutputFile output(vm["output"].as<string>());
+    if (!output.isOpen()) {
+        return 1;
+    }
+
+    terrain_to_obj(output.stream(), elevPath, *projDef, vm.count("float") > 0, vm.count("optimize-mesh") > 0, x1, y1, x2, y2);
 
-    return 0;
+    return output.close() ? 0 : 1;
 }
 
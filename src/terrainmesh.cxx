@@ -0,0 +1,434 @@
+#include <iostream>
+#include <math.h>
+#include <atomic>
+#include <memory>
+#include <algorithm>
+#include <proj_api.h>
+#include "terrainmesh.hxx"
+#include "parallel.hxx"
+#include "projection.hxx"
+#include "hilbert.hxx"
+#include "meshopt.hxx"
+
+using namespace std;
+
+namespace osmwave {
+    template <typename Real>
+    void BasicTerrainMesh<Real>::resize(size_t n) {
+        x.resize(n);
+        y.resize(n);
+        z.resize(n);
+        nx.resize(n);
+        ny.resize(n);
+        nz.resize(n);
+    }
+
+    static double findNearHeight(int rows, int cols, int index, int dx, int dy, XYZ* verts) {
+        int s = index;
+        do {
+            s += dx * rows + dy;
+        } while (std::isnan(verts[s].z));
+
+        return verts[s].z;
+    }
+
+    static int thin(int rows, int cols, XYZ* verts, double tolerance) {
+        int index = 0;
+        int nonEmpty = 0;
+
+        for (int i = 1; i < cols - 1; i++) {
+            for (int j = 1; j < rows - 1; j++) {
+                if (!std::isnan(verts[index].z)) {
+                    double e1 = verts[index].z;
+                    double e2 = findNearHeight(rows, cols, index, 1, -1, verts);
+                    double e3 = findNearHeight(rows, cols, index, 1, 0, verts);
+                    double e4 = findNearHeight(rows, cols, index, 1, 1, verts);
+                    double d2 = abs(e1 - e2);
+                    double d3 = abs(e1 - e3);
+                    double d4 = abs(e1 - e4);
+
+                    if (d2 <= tolerance &&
+                        d3 <= tolerance &&
+                        d4 <= tolerance) {
+                        verts[index].z = NAN;
+                    } else {
+                        nonEmpty++;
+                    }
+                }
+
+                index++;
+            }
+        }
+
+        return nonEmpty;
+    }
+
+    // Branch free, so that it vectorizes; zero length vectors stay zero.
+    template <typename Real>
+    static void normalize(Real* __restrict x, Real* __restrict y, Real* __restrict z, size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            Real l = sqrt(x[i]*x[i] + y[i]*y[i] + z[i]*z[i]);
+            Real s = l > 0 ? 1 / l : 0;
+            x[i] *= s;
+            y[i] *= s;
+            z[i] *= s;
+        }
+    }
+
+    template <typename Real>
+    static void faceNormals(const BasicTerrainMesh<Real>& mesh, size_t begin, size_t end,
+        Real* __restrict fx, Real* __restrict fy, Real* __restrict fz) {
+        const Real* x = mesh.x.data();
+        const Real* y = mesh.y.data();
+        const Real* z = mesh.z.data();
+
+        for (size_t i = begin; i < end; i++) {
+            const ITRIANGLE& tri = mesh.triangles[i];
+            Real ux = x[tri.p2] - x[tri.p1], uy = y[tri.p2] - y[tri.p1], uz = z[tri.p2] - z[tri.p1];
+            Real vx = x[tri.p3] - x[tri.p1], vy = y[tri.p3] - y[tri.p1], vz = z[tri.p3] - z[tri.p1];
+            fx[i] = uy*vz - uz*vy;
+            fy[i] = uz*vx - ux*vz;
+            fz[i] = ux*vy - uy*vx;
+        }
+
+        normalize(fx + begin, fy + begin, fz + begin, end - begin);
+    }
+
+    template <typename Real>
+    void BasicTerrainMesh<Real>::computeNormals() {
+        size_t nVerts = size();
+        size_t nTris = triangles.size();
+        vector<Real> fx(nTris), fy(nTris), fz(nTris);
+
+        parallel_for(nTris, [&](size_t begin, size_t end) {
+            faceNormals(*this, begin, end, fx.data(), fy.data(), fz.data());
+        });
+
+        // Vertex to triangle adjacency in compressed row form, so every
+        // vertex normal is gathered by exactly one thread without locking.
+        unique_ptr<atomic<int>[]> counts(new atomic<int>[nVerts]);
+        parallel_for(nVerts, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                counts[i].store(0, memory_order_relaxed);
+            }
+        });
+        parallel_for(nTris, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                counts[triangles[i].p1].fetch_add(1, memory_order_relaxed);
+                counts[triangles[i].p2].fetch_add(1, memory_order_relaxed);
+                counts[triangles[i].p3].fetch_add(1, memory_order_relaxed);
+            }
+        });
+
+        vector<int> offsets(nVerts + 1);
+        offsets[0] = 0;
+        for (size_t i = 0; i < nVerts; i++) {
+            offsets[i + 1] = offsets[i] + counts[i].load(memory_order_relaxed);
+            counts[i].store(offsets[i], memory_order_relaxed);
+        }
+
+        vector<int> adjacent(offsets[nVerts]);
+        parallel_for(nTris, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                adjacent[counts[triangles[i].p1].fetch_add(1, memory_order_relaxed)] = i;
+                adjacent[counts[triangles[i].p2].fetch_add(1, memory_order_relaxed)] = i;
+                adjacent[counts[triangles[i].p3].fetch_add(1, memory_order_relaxed)] = i;
+            }
+        });
+
+        parallel_for(nVerts, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                // Fill order above depends on thread timing; sorting keeps
+                // the summation order, and so the output, deterministic.
+                sort(adjacent.begin() + offsets[i], adjacent.begin() + offsets[i + 1]);
+
+                Real sx = 0, sy = 0, sz = 0;
+                for (int j = offsets[i]; j < offsets[i + 1]; j++) {
+                    int t = adjacent[j];
+                    sx += fx[t];
+                    sy += fy[t];
+                    sz += fz[t];
+                }
+                nx[i] = sx;
+                ny[i] = sy;
+                nz[i] = sz;
+            }
+
+            normalize(nx.data() + begin, ny.data() + begin, nz.data() + begin, end - begin);
+        });
+    }
+
+    template <typename Real>
+    TerrainSampler<Real>::TerrainSampler(const BasicTerrainMesh<Real>& mesh) : mesh(mesh), minX(0), minY(0), cellSize(1), cols(1), rows(1) {
+        size_t nTris = mesh.triangles.size();
+        if (nTris == 0) {
+            cellStart.assign(2, 0);
+            return;
+        }
+
+        minX = *min_element(mesh.x.begin(), mesh.x.end());
+        minY = *min_element(mesh.y.begin(), mesh.y.end());
+        double width = *max_element(mesh.x.begin(), mesh.x.end()) - minX;
+        double height = *max_element(mesh.y.begin(), mesh.y.end()) - minY;
+
+        // Aim for a couple of triangles per cell
+        cellSize = max(sqrt(width * height / (nTris / 2 + 1)), 1e-6);
+        cols = (int)(width / cellSize) + 1;
+        rows = (int)(height / cellSize) + 1;
+        cellStart.assign((size_t)cols * rows + 1, 0);
+
+        int c0, r0, c1, r1;
+        for (auto& tri : mesh.triangles) {
+            cellRange(tri, c0, r0, c1, r1);
+            for (int r = r0; r <= r1; r++) {
+                for (int c = c0; c <= c1; c++) {
+                    cellStart[r * cols + c + 1]++;
+                }
+            }
+        }
+
+        for (size_t i = 1; i < cellStart.size(); i++) {
+            cellStart[i] += cellStart[i - 1];
+        }
+
+        vector<int> fill(cellStart.begin(), cellStart.end() - 1);
+        cellTriangles.resize(cellStart.back());
+        for (size_t i = 0; i < nTris; i++) {
+            cellRange(mesh.triangles[i], c0, r0, c1, r1);
+            for (int r = r0; r <= r1; r++) {
+                for (int c = c0; c <= c1; c++) {
+                    cellTriangles[fill[r * cols + c]++] = i;
+                }
+            }
+        }
+    }
+
+    template <typename Real>
+    void TerrainSampler<Real>::cellRange(const ITRIANGLE& tri, int& c0, int& r0, int& c1, int& r1) const {
+        double x0 = min(mesh.x[tri.p1], min(mesh.x[tri.p2], mesh.x[tri.p3]));
+        double x1 = max(mesh.x[tri.p1], max(mesh.x[tri.p2], mesh.x[tri.p3]));
+        double y0 = min(mesh.y[tri.p1], min(mesh.y[tri.p2], mesh.y[tri.p3]));
+        double y1 = max(mesh.y[tri.p1], max(mesh.y[tri.p2], mesh.y[tri.p3]));
+        c0 = (int)((x0 - minX) / cellSize);
+        c1 = min(cols - 1, (int)((x1 - minX) / cellSize));
+        r0 = (int)((y0 - minY) / cellSize);
+        r1 = min(rows - 1, (int)((y1 - minY) / cellSize));
+    }
+
+    template <typename Real>
+    bool TerrainSampler<Real>::height(double x, double y, double& z) const {
+        double fc = (x - minX) / cellSize;
+        double fr = (y - minY) / cellSize;
+        if (!(fc >= 0 && fc < cols && fr >= 0 && fr < rows)) {
+            return false;
+        }
+
+        int cell = (int)fr * cols + (int)fc;
+        for (int i = cellStart[cell]; i < cellStart[cell + 1]; i++) {
+            const ITRIANGLE& tri = mesh.triangles[cellTriangles[i]];
+            double x1 = mesh.x[tri.p1], y1 = mesh.y[tri.p1];
+            double x2 = mesh.x[tri.p2], y2 = mesh.y[tri.p2];
+            double x3 = mesh.x[tri.p3], y3 = mesh.y[tri.p3];
+            double d = (y2 - y3) * (x1 - x3) + (x3 - x2) * (y1 - y3);
+            if (d == 0) {
+                continue;
+            }
+
+            double a = ((y2 - y3) * (x - x3) + (x3 - x2) * (y - y3)) / d;
+            double b = ((y3 - y1) * (x - x3) + (x1 - x3) * (y - y3)) / d;
+            double c = 1 - a - b;
+            const double eps = -1e-9;
+            if (a >= eps && b >= eps && c >= eps) {
+                z = a * mesh.z[tri.p1] + b * mesh.z[tri.p2] + c * mesh.z[tri.p3];
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    template <typename Real>
+    void build_terrain(BasicTerrainMesh<Real>& mesh, const Elevation& elevation, const std::string& projDef, const LocalFrame& frame, double x1, double y1, double x2, double y2) {
+        double step = 1.0 / 3600;
+        int rows = (int)floor((y2 - y1) / step + 1);
+        int cols = (int)floor((x2 - x1) / step + 1);
+        double bounds[] = {x1*DEG_TO_RAD, y1*DEG_TO_RAD, x2*DEG_TO_RAD, y2*DEG_TO_RAD};
+
+        // Own projection, since proj objects may not be shared between
+        // threads.
+        Projection projection(projDef);
+        projection.forward(bounds, 2);
+
+        cerr << "rows: " << rows << ", cols: " << cols << endl;
+        cerr << "bounds: " << bounds[0] << ", " << bounds[1] << " - " << bounds[2] << ", " << bounds[3] << endl;
+
+        cerr << "Calculating vertices..." << endl;
+        XYZ* coords = new XYZ[rows * cols + 3];
+
+        int i = 0;
+        vector<double> ll(rows * 2);
+        // Having columns as outer loop ensures x will be growing,
+        // which is a requirement for the triangulation algorithm,
+        // as long as projection is west to east.
+        for (int c = 0; c < cols; c++) {
+            double x = bounds[0] + (bounds[2] - bounds[0]) * c / cols;
+            for (int r = 0; r < rows; r++) {
+                ll[r * 2] = x;
+                ll[r * 2 + 1] = bounds[1] + (bounds[3] - bounds[1]) * r / rows;
+            }
+            // A column at a time, so the inverse runs on a batch
+            projection.inverse(ll.data(), rows);
+
+            for (int r = 0; r < rows; r++) {
+                double y = bounds[1] + (bounds[3] - bounds[1]) * r / rows;
+
+                XYZ& coord = coords[i++];
+                coord.x = x;
+                coord.y = y;
+                coord.z = elevation.elevation(ll[r * 2 + 1]*RAD_TO_DEG, ll[r * 2]*RAD_TO_DEG);
+
+                //cerr << (ll[0] * RAD_TO_DEG) << ", " << (ll[1] * RAD_TO_DEG) << " (" << coord.x << ", " << coord.y << "): " << coord.z << endl;
+            }
+        }
+
+        int startCount = rows * cols,
+            lastCount = 0,
+            count = -1;
+        cerr << "Thinning " << startCount << " vertices..." << endl;
+        while (lastCount != count) {
+            lastCount = count;
+            count = thin(rows, cols, coords, 2);
+        }
+
+        int j = 0;
+        for (int i = 0; i < rows * cols; i++) {
+            if (!std::isnan(coords[i].z)) {
+                coords[j++] = coords[i];
+            }
+        }
+        cerr << "Thinned to " << j << " vertices" << endl;
+
+        cerr << "Triangulating..." << endl;
+        ITRIANGLE *tris = new ITRIANGLE[3 * rows * cols];
+        int numTriangles;
+        Triangulate(j, coords, tris, numTriangles);
+        cerr << numTriangles << " triangles" << endl;
+
+        mesh.resize(j);
+        for (int i = 0; i < j; i++) {
+            mesh.x[i] = coords[i].x - frame.originX;
+            mesh.y[i] = coords[i].y - frame.originY;
+            mesh.z[i] = coords[i].z;
+        }
+        mesh.triangles.assign(tris, tris + numTriangles);
+        delete[] coords;
+        delete[] tris;
+
+        cerr << "Calculating normals..." << endl;
+        mesh.computeNormals();
+    }
+
+    template <typename Real>
+    void write_terrain(ObjWriter& writer, const BasicTerrainMesh<Real>& mesh, bool optimize) {
+        writer.checkpoint();
+        if (!optimize || mesh.triangles.empty()) {
+            for (size_t i = 0; i < mesh.size(); i++) {
+                writer.vertex(mesh.y[i], mesh.z[i], mesh.x[i], mesh.ny[i], mesh.nz[i], mesh.nx[i]);
+            }
+
+            for (auto& tri : mesh.triangles) {
+                writer.beginFace();
+                writer << tri.p1 << tri.p2 << tri.p3;
+                writer.endFace();
+            }
+            return;
+        }
+
+        size_t nTriangles = mesh.triangles.size();
+        vector<uint32_t> indices(nTriangles * 3);
+        for (size_t i = 0; i < nTriangles; i++) {
+            indices[i * 3] = mesh.triangles[i].p1;
+            indices[i * 3 + 1] = mesh.triangles[i].p2;
+            indices[i * 3 + 2] = mesh.triangles[i].p3;
+        }
+
+        // Triangles are optimized in chunks of the Hilbert chunk grid, by
+        // the first corner, which also orders the chunks spatially
+        auto minX = *min_element(mesh.x.begin(), mesh.x.end()), maxX = *max_element(mesh.x.begin(), mesh.x.end());
+        auto minY = *min_element(mesh.y.begin(), mesh.y.end()), maxY = *max_element(mesh.y.begin(), mesh.y.end());
+        const uint32_t side = 1 << HILBERT_CHUNK_ORDER;
+        double scaleX = side / max((double)(maxX - minX), 1e-6), scaleY = side / max((double)(maxY - minY), 1e-6);
+        vector<uint32_t> chunks(nTriangles);
+        for (size_t i = 0; i < nTriangles; i++) {
+            int v = mesh.triangles[i].p1;
+            uint32_t cx = min((uint32_t)((mesh.x[v] - minX) * scaleX), side - 1);
+            uint32_t cy = min((uint32_t)((mesh.y[v] - minY) * scaleY), side - 1);
+            chunks[i] = (uint32_t)hilbert_key(cx, cy, HILBERT_CHUNK_ORDER);
+        }
+
+        size_t before = vertex_cache_misses(indices.data(), indices.size(), mesh.size());
+        vector<uint32_t> order;
+        optimize_mesh(indices, chunks, mesh.size(), order);
+        size_t after = vertex_cache_misses(indices.data(), indices.size(), mesh.size());
+        cerr << "Terrain vertex cache miss ratio: " << (double)before / max<size_t>(nTriangles, 1) << " before optimization, " <<
+            (double)after / max<size_t>(nTriangles, 1) << " after" << endl;
+
+        for (uint32_t i : order) {
+            writer.vertex(mesh.y[i], mesh.z[i], mesh.x[i], mesh.ny[i], mesh.nz[i], mesh.nx[i]);
+        }
+
+        for (size_t i = 0; i < indices.size(); i += 3) {
+            writer.beginFace();
+            writer << (int)indices[i] << (int)indices[i + 1] << (int)indices[i + 2];
+            writer.endFace();
+        }
+    }
+
+    template struct BasicTerrainMesh<float>;
+    template struct BasicTerrainMesh<double>;
+    template class TerrainSampler<float>;
+    template class TerrainSampler<double>;
+    template void build_terrain(BasicTerrainMesh<float>&, const Elevation&, const std::string&, const LocalFrame&, double, double, double, double);
+    template void build_terrain(BasicTerrainMesh<double>&, const Elevation&, const std::string&, const LocalFrame&, double, double, double, double);
+    template void write_terrain(ObjWriter&, const BasicTerrainMesh<float>&, bool);
+    template void write_terrain(ObjWriter&, const BasicTerrainMesh<double>&, bool);
+
+    BackgroundTerrain::BackgroundTerrain(const Elevation& elevation, const std::string& projDef, const LocalFrame& frame, double x1, double y1, double x2, double y2, bool optimize) :
+        optimize(optimize), ready(false) {
+        if (frame.single) {
+            singleMesh.reset(new BasicTerrainMesh<float>());
+        } else {
+            doubleMesh.reset(new BasicTerrainMesh<double>());
+        }
+
+        done = async(launch::async, [this, &elevation, projDef, frame, x1, y1, x2, y2]() {
+            if (singleMesh) {
+                build_terrain(*singleMesh, elevation, projDef, frame, x1, y1, x2, y2);
+            } else {
+                build_terrain(*doubleMesh, elevation, projDef, frame, x1, y1, x2, y2);
+            }
+        });
+    }
+
+    BackgroundTerrain::~BackgroundTerrain() {
+        if (done.valid()) {
+            done.wait();
+        }
+    }
+
+    void BackgroundTerrain::get(ObjWriter& writer) {
+        if (ready) {
+            return;
+        }
+
+        done.get();
+        if (singleMesh) {
+            write_terrain(writer, *singleMesh, optimize);
+            singleSampler.reset(new TerrainSampler<float>(*singleMesh));
+        } else {
+            write_terrain(writer, *doubleMesh, optimize);
+            doubleSampler.reset(new TerrainSampler<double>(*doubleMesh));
+        }
+        ready = true;
+    }
+}
@@ -0,0 +1,107 @@
+#ifndef __TERRAINMESH_HXX__
+#define __TERRAINMESH_HXX__
+
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+#include "Delaunay.h"
+#include "elevation.hxx"
+#include "ObjWriter.hxx"
+#include "localframe.hxx"
+
+using namespace std;
+
+namespace osmwave {
+    // Terrain vertices and normals in structure-of-arrays form, so that
+    // per-vertex passes run over contiguous arrays. Positions are relative
+    // to the origin of a LocalFrame; single precision meshes take half
+    // the memory and twice the SIMD lanes.
+    template <typename Real>
+    struct BasicTerrainMesh {
+        vector<Real> x;
+        vector<Real> y;
+        vector<Real> z;
+        vector<Real> nx;
+        vector<Real> ny;
+        vector<Real> nz;
+        vector<ITRIANGLE> triangles;
+
+        size_t size() const { return x.size(); }
+        void resize(size_t n);
+
+        // Sets each vertex normal to the normalized sum of the unit normals
+        // of its adjacent triangles.
+        void computeNormals();
+    };
+
+    typedef BasicTerrainMesh<double> TerrainMesh;
+
+    // Finds the height of the terrain surface at local coordinates, using
+    // a uniform grid of cells listing the triangles overlapping them.
+    template <typename Real>
+    class TerrainSampler {
+        const BasicTerrainMesh<Real>& mesh;
+        double minX;
+        double minY;
+        double cellSize;
+        int cols;
+        int rows;
+        vector<int> cellStart;
+        vector<int> cellTriangles;
+
+    public:
+        TerrainSampler(const BasicTerrainMesh<Real>& mesh);
+
+        // Returns false if (x, y) is outside the mesh.
+        bool height(double x, double y, double& z) const;
+
+    private:
+        void cellRange(const ITRIANGLE& tri, int& c0, int& r0, int& c1, int& r1) const;
+    };
+
+    // Samples a grid of one arc second over the lat/lng box (x1, y1) - (x2, y2),
+    // thins out vertices in flat areas and triangulates them, in the projected
+    // coordinates of projDef relative to the frame's origin. Safe to run on a
+    // thread of its own.
+    template <typename Real>
+    void build_terrain(BasicTerrainMesh<Real>& mesh, const Elevation& elevation, const std::string& projDef, const LocalFrame& frame, double x1, double y1, double x2, double y2);
+
+    // Writes the mesh; when optimizing, triangles are reordered for the
+    // vertex cache and vertices renumbered in first use order, see
+    // optimize_mesh.
+    template <typename Real>
+    void write_terrain(ObjWriter& writer, const BasicTerrainMesh<Real>& mesh, bool optimize = false);
+
+    // Terrain mesh built on a background thread while other work goes on.
+    // It is written to the model the first time it is needed, which puts
+    // it before any geometry placed on it.
+    // The mesh is single or double precision, following the frame.
+    class BackgroundTerrain {
+        unique_ptr<BasicTerrainMesh<float>> singleMesh;
+        unique_ptr<BasicTerrainMesh<double>> doubleMesh;
+        unique_ptr<TerrainSampler<float>> singleSampler;
+        unique_ptr<TerrainSampler<double>> doubleSampler;
+        bool optimize;
+        bool ready;
+        future<void> done;
+
+    public:
+        BackgroundTerrain(const Elevation& elevation, const std::string& projDef, const LocalFrame& frame, double x1, double y1, double x2, double y2, bool optimize = false);
+        ~BackgroundTerrain();
+
+        // Waits for the mesh and writes it, unless already done
+        void get(ObjWriter& writer);
+
+        // Height of the terrain at local coordinates (x, y), see TerrainSampler
+        bool height(ObjWriter& writer, double x, double y, double& z) {
+            if (!ready) {
+                get(writer);
+            }
+
+            return singleSampler ? singleSampler->height(x, y, z) : doubleSampler->height(x, y, z);
+        }
+    };
+}
+
+#endif